@@ -2,16 +2,152 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <deque>
+#include <memory>
+#include <numeric>
 #include <chrono>
 #include <tuple>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 typedef __uint128_t ull128;
 typedef unsigned long long ull;
 
-std::mutex mtx;
-ull total_triplet_count = 0; // Global count of total Cardano Triplets
+ull total_triplet_count = 0; // Global count of total Cardano Triplets, reduced from the per-thread counters
+
+class TripletWriter;
+
+// Per-thread triplet counter padded to its own cache line so threads never share one
+struct alignas(64) PaddedCounter {
+    ull value = 0;
+    std::vector<ull> histogram;      // Multi-threshold mode: hits bucketed by the smallest threshold >= a + b + c,
+                                     // allocated by the owning thread
+    TripletWriter* writer = nullptr; // Export mode: where this thread's triplets go
+};
+
+// Multi-threshold mode: ascending, distinct limits on a + b + c answered from a single sweep
+// up to the largest one. Empty for an ordinary single max_sum run.
+std::vector<ull128> thresholds;
+
+// Fixed-capacity factorization of N_div, so no allocation happens per 'a'.
+// N_div = (k + 1)^2 (8k + 5) itself can be far above 2^128, so the sizes follow from its factors:
+// for k <= K_MAX_128 we have k + 1 <= 2^125 and 8k + 5 < 2^128, each with at most 25 distinct primes
+// (2 * 3 * ... * 101 > 2^125, and the odd 3 * 5 * ... * 103 > 2^128). (k + 1)^2 has at most 2 * 125
+// prime factors and 8k + 5 at most 80 (3^81 > 2^128), so the power tables hold at most 330 + 50 entries.
+const size_t MAX_FACTORS = 64;
+const size_t MAX_PRIME_POWERS = 384;
+const ull128 K_MAX_128 = (~static_cast<ull128>(0) - 5) / 8; // Largest k with 8k + 5 < 2^128
+
+template <typename UInt>
+struct BasicFactorList {
+    UInt prime[MAX_FACTORS];
+    unsigned exp[MAX_FACTORS];
+    size_t size = 0;
+
+    void clear() { size = 0; }
+    void add(UInt p, unsigned e) {
+        prime[size] = p;
+        exp[size++] = e;
+    }
+    bool operator==(const BasicFactorList& other) const {
+        if (size != other.size)
+            return false;
+        for (size_t i = 0; i < size; ++i)
+            if (prime[i] != other.prime[i] || exp[i] != other.exp[i])
+                return false;
+        return true;
+    }
+};
+
+typedef BasicFactorList<ull128> FactorList;
+
+// Hot-path instrumentation, compiled in with -DEULER251_STATS and compiled out otherwise.
+// Each thread fills its own thread_local HotPathStats, which is appended to
+// hot_stats_threads when the thread finishes and written as JSON at exit.
+#ifdef EULER251_STATS
+#define EULER251_STAT(stmt) do { stmt; } while (0)
+#define EULER251_PHASE(field) PhaseTimer phase_timer_##field(hot_stats.field)
+#else
+#define EULER251_STAT(stmt) do {} while (0)
+#define EULER251_PHASE(field) do {} while (0)
+#endif
+
+struct HotPathStats {
+    double factor_seconds = 0;          // Sieving / rho plus merging into the N_div factor list
+    double walk_seconds = 0;            // generate_bc, or stepping k in the square engine
+    ull trial_divisions = 0;            // Divisibility tests n % p
+    ull values_factored = 0;            // N_div values factored
+    ull distinct_primes[MAX_FACTORS + 1] = {}; // Histogram of distinct prime factors per N_div
+    ull leaves_visited = 0;             // Complete (b, c) candidates evaluated
+    ull leaves_accepted = 0;            // ... of which a + b + c <= max_sum
+    ull branches_pruned = 0;            // Inner divisor-tree branches cut by the bound
+    ull square_pairs = 0;               // (q, d) pairs whose k progression was walked
+};
+
+#ifdef EULER251_STATS
+thread_local HotPathStats hot_stats;
+std::mutex hot_stats_lock;
+std::vector<HotPathStats> hot_stats_threads;
+
+// Adds the elapsed time of its scope to a HotPathStats field
+class PhaseTimer {
+public:
+    explicit PhaseTimer(double& total) : total_(total), start_(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+        total_ += elapsed.count();
+    }
+
+private:
+    double& total_;
+    std::chrono::steady_clock::time_point start_;
+};
+#endif
+
+// Function to hand the calling thread's counters over for the JSON dump
+void publish_hot_stats() {
+#ifdef EULER251_STATS
+    std::lock_guard<std::mutex> guard(hot_stats_lock);
+    hot_stats_threads.push_back(hot_stats);
+    hot_stats = HotPathStats();
+#endif
+}
+
+// The kernels below are instantiated for uint64_t and ull128. The 64-bit instantiation is used
+// for every k whose factors k + 1 and 8k + 5 fit in 64 bits, as long as max_sum does: N_div
+// itself may overflow, but generate_bc only forms b and c below max_sum. The sieve is 64-bit
+// only, so sieve sweeps stop at k = K_MAX_64; the 128-bit kernels serve --rho sweeps past that
+// (k itself stays below 2^64) and the point queries.
+const ull K_MAX_64 = (UINT64_MAX - 5) / 8; // Largest k with 8k + 5 < 2^64
+
+// Segmented sieve parameters: with a = 3k + 2 we have N / 27 = (k + 1)^2 (8k + 5),
+// so both factors are sieved over k one block at a time instead of trial dividing N_div
+const size_t SIEVE_BLOCK = 1 << 13;   // Values of k per block, keeps a thread's buffers around 1 MB
+const size_t FACTOR_BATCH = 64;       // Values of k factored before their pairs are walked, so the
+                                      // phase timers run once per batch rather than once per 'a'
+const size_t MAX_SIEVE_FACTORS = 15;  // Distinct primes <= sqrt(limit) of a 64-bit value
+
+std::vector<uint32_t> base_primes;    // Primes up to sqrt(8 * k_max + 5), shared read-only by all threads
+std::vector<uint32_t> base_roots;     // For each base prime p: the k (mod p) with p | 8k + 5
+
+// Where find_cardano_triplets gets the factorization of N_div from
+enum class FactorSource { Sieve, Rho };
+FactorSource factor_source = FactorSource::Sieve;
+
+// How the triplets are enumerated: factor N_div for every a, or walk the square part of b^2 c
+enum class Engine { Divisor, Square };
 
 // Custom function to handle input for __uint128_t
 std::istream& operator>>(std::istream& in, ull128& value) {
@@ -41,115 +177,1275 @@ std::ostream& operator<<(std::ostream& os, const ull128& value) {
     return os << str;
 }
 
-// Integer exponentiation for 128-bit numbers
-ull128 int_pow(ull128 base, ull128 exp) {
-    ull128 result = 1;
-    while (exp > 0) {
-        if (exp & 1)
-            result *= base;
-        base *= base;
-        exp >>= 1;
-    }
-    return result;
-}
-
 // Function to factorize n using trial division
-void factorize(ull128 n, std::vector<std::pair<ull128, ull128>>& factors) {
-    for (ull128 i = 2; i * i <= n; ++i) {
-        ull128 count = 0;
+template <typename UInt>
+void factorize(UInt n, BasicFactorList<UInt>& factors) {
+    for (UInt i = 2; i * i <= n; ++i) {
+        unsigned count = 0;
+        EULER251_STAT(hot_stats.trial_divisions++);
         while (n % i == 0) {
             n /= i;
             ++count;
+            EULER251_STAT(hot_stats.trial_divisions++);
         }
         if (count > 0) {
-            factors.emplace_back(i, count);
+            factors.add(i, count);
         }
     }
     if (n > 1) {
-        factors.emplace_back(n, 1); // n is prime
+        factors.add(n, 1); // n is prime
     }
 }
 
-// Recursive function to generate all possible (b, c) pairs and count them
-void generate_bc(const std::vector<std::pair<ull128, ull128>>& factors, size_t idx, ull128 b, ull128 c, ull128 max_sum, ull128 a) {
-    if (idx == factors.size()) {
-        if (a + b + c <= max_sum && b > 0 && c > 0) {
-            if (b > c) std::swap(b, c); // Ensure b <= c
-            std::lock_guard<std::mutex> lock(mtx);
-            total_triplet_count++;
+// ---------------------------------------------------------------------------
+// Montgomery arithmetic, Miller-Rabin and Brent's Pollard-rho for ull128 values.
+// Used for point queries on single (or sparse) values of 'a', where sieving a
+// whole block is wasted work and trial division up to sqrt(N_div) is hopeless.
+// ---------------------------------------------------------------------------
+
+// Full 128 x 128 -> 256-bit product split into high and low halves
+static inline void mul_wide(ull128 x, ull128 y, ull128& hi, ull128& lo) {
+    ull x0 = static_cast<ull>(x), x1 = static_cast<ull>(x >> 64);
+    ull y0 = static_cast<ull>(y), y1 = static_cast<ull>(y >> 64);
+    ull128 p00 = static_cast<ull128>(x0) * y0;
+    ull128 p01 = static_cast<ull128>(x0) * y1;
+    ull128 p10 = static_cast<ull128>(x1) * y0;
+    ull128 p11 = static_cast<ull128>(x1) * y1;
+    ull128 mid = (p00 >> 64) + static_cast<ull>(p01) + static_cast<ull>(p10);
+    lo = (mid << 64) | static_cast<ull>(p00);
+    hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+}
+
+static inline int ctz128(ull128 x) {
+    ull low = static_cast<ull>(x);
+    return low ? __builtin_ctzll(low) : 64 + __builtin_ctzll(static_cast<ull>(x >> 64));
+}
+
+// Binary GCD for 128-bit numbers
+static ull128 gcd128(ull128 x, ull128 y) {
+    if (x == 0) return y;
+    if (y == 0) return x;
+    int shift = ctz128(x | y);
+    x >>= ctz128(x);
+    do {
+        y >>= ctz128(y);
+        if (x > y) std::swap(x, y);
+        y -= x;
+    } while (y != 0);
+    return x << shift;
+}
+
+// Montgomery form modulo an odd n < 2^128 with R = 2^128
+struct Montgomery128 {
+    ull128 n;
+    ull128 n_inv; // n^-1 mod 2^128
+    ull128 one;   // R mod n
+    ull128 r2;    // R^2 mod n
+
+    explicit Montgomery128(ull128 modulus) : n(modulus) {
+        n_inv = n; // Correct to 3 bits for odd n, each Newton step doubles that
+        for (int i = 0; i < 6; ++i)
+            n_inv *= 2 - n * n_inv;
+        one = (0 - n) % n;
+        r2 = one;
+        for (int i = 0; i < 128; ++i)
+            r2 = add(r2, r2);
+    }
+
+    ull128 add(ull128 x, ull128 y) const {
+        ull128 s = x + y;
+        return (s < x || s >= n) ? s - n : s;
+    }
+
+    ull128 sub(ull128 x, ull128 y) const {
+        return x >= y ? x - y : x + (n - y);
+    }
+
+    // x * y * R^-1 mod n
+    ull128 mul(ull128 x, ull128 y) const {
+        ull128 hi, lo, mn_hi, mn_lo;
+        mul_wide(x, y, hi, lo);
+        ull128 m = lo * n_inv;
+        mul_wide(m, n, mn_hi, mn_lo); // mn_lo == lo, so the low halves cancel
+        return hi >= mn_hi ? hi - mn_hi : hi + (n - mn_hi);
+    }
+
+    ull128 to(ull128 x) const { return mul(x % n, r2); }
+    ull128 from(ull128 x) const { return mul(x, 1); }
+
+    ull128 pow(ull128 base, ull128 exp) const {
+        ull128 result = one;
+        while (exp > 0) {
+            if (exp & 1)
+                result = mul(result, base);
+            base = mul(base, base);
+            exp >>= 1;
+        }
+        return result;
+    }
+};
+
+// Miller-Rabin with the first 13 prime bases (2 .. 41): deterministic for n < 3317044064679887385961981
+// (about 3.3 * 10^24), which covers k + 1 and 8k + 5 for a below about 1.2 * 10^24. Larger n get the
+// same fixed bases plus the next primes up to 71 (no known counterexample, but not a proof).
+bool is_prime_128(ull128 n) {
+    static const unsigned small_primes[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37,
+                                            41, 43, 47, 53, 59, 61, 67, 71};
+    if (n < 2) return false;
+    for (unsigned p : small_primes) {
+        if (n == p) return true;
+        if (n % p == 0) return false;
+    }
+    if (n < 71 * 71) return true;
+
+    const ull128 DETERMINISTIC_LIMIT = static_cast<ull128>(3317044064679887ULL) * 1000000000ULL + 385961981ULL; // 3.317 * 10^24
+    size_t num_bases = n < DETERMINISTIC_LIMIT ? 13 : sizeof(small_primes) / sizeof(small_primes[0]);
+
+    Montgomery128 mont(n);
+    ull128 d = n - 1;
+    int s = ctz128(d);
+    d >>= s;
+    ull128 minus_one = n - mont.one;
+
+    for (size_t i = 0; i < num_bases; ++i) {
+        ull128 x = mont.pow(mont.to(small_primes[i]), d);
+        if (x == mont.one || x == minus_one)
+            continue;
+        bool composite = true;
+        for (int r = 1; r < s; ++r) {
+            x = mont.mul(x, x);
+            if (x == minus_one) {
+                composite = false;
+                break;
+            }
         }
+        if (composite)
+            return false;
+    }
+    return true;
+}
+
+// Brent's variant of Pollard-rho: returns a nontrivial factor of an odd composite n
+ull128 pollard_brent(ull128 n) {
+    const ull128 BATCH = 128; // Steps between gcd computations
+    Montgomery128 mont(n);
+
+    for (ull128 c0 = 1;; ++c0) {
+        ull128 c = mont.to(c0);
+        auto f = [&](ull128 v) { return mont.add(mont.mul(v, v), c); };
+
+        ull128 y = mont.to(2), x = y, ys = y;
+        ull128 q = mont.one, g = 1;
+        for (ull128 r = 1; g == 1; r *= 2) {
+            x = y;
+            for (ull128 i = 0; i < r; ++i)
+                y = f(y);
+            for (ull128 k = 0; k < r && g == 1; k += BATCH) {
+                ys = y;
+                ull128 steps = std::min(BATCH, r - k);
+                for (ull128 i = 0; i < steps; ++i) {
+                    y = f(y);
+                    q = mont.mul(q, x > y ? x - y : y - x);
+                }
+                g = gcd128(q, n);
+            }
+        }
+
+        // The batch overshot: replay it one step at a time
+        if (g == n) {
+            do {
+                ys = f(ys);
+                g = gcd128(x > ys ? x - ys : ys - x, n);
+            } while (g == 1);
+        }
+        if (g != n)
+            return g;
+    }
+}
+
+static void collect_prime_factors(ull128 n, ull128* primes, size_t& count) {
+    if (n == 1)
+        return;
+    if (is_prime_128(n)) {
+        primes[count++] = n;
         return;
     }
+    ull128 d = pollard_brent(n);
+    collect_prime_factors(d, primes, count);
+    collect_prime_factors(n / d, primes, count);
+}
 
-    ull128 p = factors[idx].first;
-    ull128 e = factors[idx].second;
+// Function to factorize n with Miller-Rabin and Pollard-rho; same output as factorize()
+void factorize_rho(ull128 n, FactorList& factors) {
+    // Strip small primes by trial division first, rho is wasted on them
+    for (ull p = 2; p < 64 && static_cast<ull128>(p) * p <= n; p += (p == 2 ? 1 : 2)) {
+        unsigned count = 0;
+        EULER251_STAT(hot_stats.trial_divisions++);
+        while (n % p == 0) {
+            n /= p;
+            ++count;
+            EULER251_STAT(hot_stats.trial_divisions++);
+        }
+        if (count > 0)
+            factors.add(p, count);
+    }
 
-    ull128 max_k = e / 2;
-    for (ull128 k = 0; k <= max_k; ++k) {
-        ull128 b_new = b * int_pow(p, k);
-        ull128 c_new = c * int_pow(p, e - 2 * k);
-        generate_bc(factors, idx + 1, b_new, c_new, max_sum, a);
+    ull128 primes[MAX_PRIME_POWERS];
+    size_t num_primes = 0;
+    collect_prime_factors(n, primes, num_primes);
+    std::sort(primes, primes + num_primes);
+    for (size_t i = 0; i < num_primes;) {
+        size_t j = i;
+        while (j < num_primes && primes[j] == primes[i])
+            ++j;
+        factors.add(primes[i], static_cast<unsigned>(j - i));
+        i = j;
     }
 }
 
-// Function to find Cardano Triplets in a given range of 'a'
-void find_cardano_triplets(ull128 start_a, ull128 end_a, ull128 max_sum) {
-    for (ull128 a = start_a; a <= end_a; a += 3) { // a ≡ 2 mod 3
-        ull128 N = (1 + a) * (1 + a) * (8 * a - 1);
-        if (N % 27 != 0)
+// Function to count the (b, c) pairs with b^2 c = N_div and a + b + c <= max_sum, calling visit(b, c) on each.
+// Walks the divisor tree iteratively: at depth d, b takes p_d^j and c takes p_d^(e_d - 2j).
+// A branch is cut as soon as b alone, or b plus the smallest c the remaining primes allow
+// (their odd exponents), no longer fits under max_sum - a.
+// N_div itself may not fit in UInt: powers and odd_tail saturate at the UInt maximum, which is
+// already past any limit, and b and c are only formed once the product is known not to overflow.
+template <typename UInt, typename Visit>
+ull generate_bc(const BasicFactorList<UInt>& factors, UInt max_sum, UInt a, Visit&& visit) {
+    if (a + 2 > max_sum) // b, c >= 1
+        return 0;
+    UInt limit = max_sum - a; // Bound on b + c
+    size_t n = factors.size;
+    if (n == 0) {
+        visit(UInt(1), UInt(1)); // N_div = 1, only b = c = 1
+        return 1;
+    }
+
+    // Power tables p_d^0 .. p_d^e_d packed into one pool, and the product of the
+    // odd-exponent primes from depth d on (a lower bound on what c still gains)
+    UInt pool[MAX_PRIME_POWERS + MAX_FACTORS];
+    size_t offset[MAX_FACTORS];
+    UInt odd_tail[MAX_FACTORS + 1];
+    const UInt SATURATED = ~UInt(0);
+    size_t used = 0;
+    for (size_t d = 0; d < n; ++d) {
+        offset[d] = used;
+        pool[used] = 1;
+        for (unsigned j = 1; j <= factors.exp[d]; ++j)
+            if (__builtin_mul_overflow(pool[used + j - 1], factors.prime[d], &pool[used + j]))
+                pool[used + j] = SATURATED;
+        used += factors.exp[d] + 1;
+    }
+    odd_tail[n] = 1;
+    for (size_t d = n; d-- > 0;)
+        if (__builtin_mul_overflow(odd_tail[d + 1], (factors.exp[d] & 1) ? factors.prime[d] : UInt(1), &odd_tail[d]))
+            odd_tail[d] = SATURATED;
+
+    UInt bs[MAX_FACTORS], cs[MAX_FACTORS];
+    int choice[MAX_FACTORS];
+    bs[0] = cs[0] = 1;
+    choice[0] = -1;
+
+    ull count = 0;
+    size_t d = 0;
+    while (true) {
+        int j = ++choice[d];
+        unsigned e = factors.exp[d];
+        if (j > static_cast<int>(e / 2)) {
+            if (d == 0)
+                break;
+            --d;
             continue;
-        ull128 N_div = N / 27;
+        }
 
-        // Factorize N_div
-        std::vector<std::pair<ull128, ull128>> factors;
-        factorize(N_div, factors);
+        const UInt* pw = pool + offset[d];
+        UInt b, c;
+        if (__builtin_mul_overflow(bs[d], pw[j], &b) || b > limit) {
+            choice[d] = e / 2; // b only grows with j
+            continue;
+        }
+        bool fits = !__builtin_mul_overflow(cs[d], pw[e - 2 * j], &c) && c <= (limit - b) / odd_tail[d + 1];
 
-        // Generate all possible (b, c) pairs and count them
-        generate_bc(factors, 0, 1, 1, max_sum, a);
+        if (d + 1 == n) {
+            EULER251_STAT(hot_stats.leaves_visited++);
+            if (fits) {
+                ++count; // odd_tail[n] = 1, so the bound above was exact
+                EULER251_STAT(hot_stats.leaves_accepted++);
+                visit(b, c);
+            }
+            continue;
+        }
+        if (!fits) {
+            EULER251_STAT(hot_stats.branches_pruned++);
+            continue;
+        }
+        ++d;
+        bs[d] = b;
+        cs[d] = c;
+        choice[d] = -1;
     }
+    return count;
 }
 
-int main() {
-    ull128 max_sum;
-    std::cout << "Enter the maximum value for (a + b + c): ";
-    std::cin >> max_sum;
+template <typename UInt>
+ull generate_bc(const BasicFactorList<UInt>& factors, UInt max_sum, UInt a) {
+    return generate_bc(factors, max_sum, a, [](UInt, UInt) {});
+}
 
-    auto start_time = std::chrono::high_resolution_clock::now();
+// ---------------------------------------------------------------------------
+// Binary export of the triplets themselves. Each thread buffers fixed-width
+// records and flushes them into a memory-mapped file at an offset it reserves
+// with one atomic add, so threads never wait on each other to write.
+// File layout: a 64-byte TripletFileHeader followed by record_count TripletRecords,
+// all in native (little-endian) byte order.
+// ---------------------------------------------------------------------------
 
-    // Determine the number of hardware threads available
-    unsigned int num_threads = std::thread::hardware_concurrency();
-    if (num_threads == 0)
-        num_threads = 4; // Default to 4 if unable to determine
+const char TRIPLET_FILE_MAGIC[8] = {'E', '2', '5', '1', 'T', 'R', 'I', 'P'};
+const size_t WRITER_BUFFER_RECORDS = 1 << 13; // 192 KB of records per thread between flushes
 
-    std::cout << "Number of threads: " << num_threads << std::endl;
+struct TripletRecord {
+    uint64_t a, b, c;
+};
 
-    // Estimate MAX_A based on max_sum
-    ull128 MAX_A = max_sum; // Conservative estimate
+struct TripletFileHeader {
+    char magic[8];
+    uint64_t record_size;
+    uint64_t record_count;
+    uint64_t max_sum;
+    uint64_t reserved[4];
+};
+static_assert(sizeof(TripletFileHeader) == 64, "header must stay 64 bytes");
+
+// Shared output file: hands out record slots and grows the file as slots are claimed
+class TripletFile {
+public:
+    bool open(const std::string& path, uint64_t max_sum) {
+        max_sum_ = max_sum;
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        return fd_ >= 0;
+    }
+
+    // Copy n records into the file at a freshly reserved position
+    bool write(const TripletRecord* records, size_t n) {
+        uint64_t first = next_record_.fetch_add(n, std::memory_order_relaxed);
+        off_t begin = sizeof(TripletFileHeader) + first * sizeof(TripletRecord);
+        off_t end = begin + n * sizeof(TripletRecord);
+        if (!reserve(end))
+            return false;
+
+        // Map just the pages this batch touches
+        off_t page = sysconf(_SC_PAGESIZE);
+        off_t map_begin = begin / page * page;
+        size_t map_len = static_cast<size_t>(end - map_begin);
+        void* map = mmap(nullptr, map_len, PROT_WRITE, MAP_SHARED, fd_, map_begin);
+        if (map == MAP_FAILED)
+            return false;
+        std::memcpy(static_cast<char*>(map) + (begin - map_begin), records, n * sizeof(TripletRecord));
+        munmap(map, map_len);
+        return true;
+    }
+
+    // Write the header and trim the file to the records actually written
+    bool close() {
+        uint64_t count = next_record_.load();
+        TripletFileHeader header = {};
+        std::memcpy(header.magic, TRIPLET_FILE_MAGIC, sizeof(header.magic));
+        header.record_size = sizeof(TripletRecord);
+        header.record_count = count;
+        header.max_sum = max_sum_;
+        bool ok = ftruncate(fd_, sizeof(header) + count * sizeof(TripletRecord)) == 0 &&
+                  pwrite(fd_, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+        ::close(fd_);
+        return ok;
+    }
+
+    uint64_t record_count() const { return next_record_.load(); }
+
+private:
+    bool reserve(off_t end) {
+        std::lock_guard<std::mutex> guard(grow_lock_);
+        if (end <= capacity_)
+            return true;
+        off_t capacity = std::max<off_t>(end, 2 * capacity_); // Grow geometrically
+        if (ftruncate(fd_, capacity) != 0)
+            return false;
+        capacity_ = capacity;
+        return true;
+    }
+
+    int fd_ = -1;
+    uint64_t max_sum_ = 0;
+    std::atomic<uint64_t> next_record_{0};
+    std::mutex grow_lock_;
+    off_t capacity_ = 0;
+};
+
+// Per-thread buffered writer in front of the shared file
+class TripletWriter {
+public:
+    explicit TripletWriter(TripletFile* file) : file_(file) { buffer_.reserve(WRITER_BUFFER_RECORDS); }
+    ~TripletWriter() { flush(); }
+
+    void append(uint64_t a, uint64_t b, uint64_t c) {
+        buffer_.push_back({a, b, c});
+        if (buffer_.size() == WRITER_BUFFER_RECORDS)
+            flush();
+    }
+
+    void flush() {
+        if (!buffer_.empty() && !file_->write(buffer_.data(), buffer_.size()))
+            failed_ = true;
+        buffer_.clear();
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    TripletFile* file_;
+    std::vector<TripletRecord> buffer_;
+    bool failed_ = false;
+};
 
-    ull128 range = MAX_A / num_threads + 1; // Ensure full coverage
+// Function to check one record: a ≡ 2 mod 3, b, c >= 1, a + b + c <= max_sum and
+// (a + 1)^2 (8a - 1) = 27 b^2 c, with every product checked for 128-bit overflow
+bool verify_record(const TripletRecord& r, uint64_t max_sum) {
+    if (r.a % 3 != 2 || r.b == 0 || r.c == 0)
+        return false;
+    ull128 sum = static_cast<ull128>(r.a) + r.b + r.c;
+    if (sum > max_sum)
+        return false;
+
+    ull128 lhs, rhs;
+    ull128 a1 = static_cast<ull128>(r.a) + 1;
+    if (__builtin_mul_overflow(a1, a1, &lhs) ||
+        __builtin_mul_overflow(lhs, 8 * static_cast<ull128>(r.a) - 1, &lhs))
+        return false;
+    if (__builtin_mul_overflow(static_cast<ull128>(r.b), r.b, &rhs) ||
+        __builtin_mul_overflow(rhs, static_cast<ull128>(r.c), &rhs) ||
+        __builtin_mul_overflow(rhs, static_cast<ull128>(27), &rhs))
+        return false;
+    return lhs == rhs;
+}
+
+// Function to re-check every record of an exported file in parallel; returns the number of bad records
+ull verify_triplet_file(const std::string& path, unsigned int num_threads) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return ULLONG_MAX;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if (static_cast<size_t>(st.st_size) < sizeof(TripletFileHeader)) {
+        std::cerr << path << " is too short to hold a header" << std::endl;
+        ::close(fd);
+        return ULLONG_MAX;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Cannot map " << path << std::endl;
+        return ULLONG_MAX;
+    }
+
+    const TripletFileHeader* header = static_cast<const TripletFileHeader*>(map);
+    const TripletRecord* records = reinterpret_cast<const TripletRecord*>(header + 1);
+    if (std::memcmp(header->magic, TRIPLET_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(TripletRecord) ||
+        sizeof(TripletFileHeader) + header->record_count * sizeof(TripletRecord) != static_cast<size_t>(st.st_size)) {
+        std::cerr << path << " is not a valid triplet file" << std::endl;
+        munmap(map, st.st_size);
+        return ULLONG_MAX;
+    }
+
+    uint64_t count = header->record_count;
+    std::vector<PaddedCounter> bad(num_threads);
     std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            uint64_t begin = count * t / num_threads, end = count * (t + 1) / num_threads;
+            for (uint64_t i = begin; i < end; ++i)
+                if (!verify_record(records[i], header->max_sum))
+                    bad[t].value++;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
 
-    for (unsigned int i = 0; i < num_threads; ++i) {
-        ull128 start_a = 2 + i * range;
-        if (start_a % 3 != 2)
-            start_a += (3 - (start_a % 3) + 2) % 3; // Adjust to a ≡ 2 mod 3
-        ull128 end_a = std::min(start_a + range - 1, MAX_A);
+    ull total_bad = 0;
+    for (const auto& b : bad)
+        total_bad += b.value;
+    std::cout << "Verified " << count << " triplets with a + b + c <= " << header->max_sum
+              << ": " << total_bad << " failed the Cardano identity" << std::endl;
+    munmap(map, st.st_size);
+    return total_bad;
+}
+
+// Function to convert the thresholds to UInt, clamped to max_sum (exact for the 64-bit kernels)
+template <typename UInt>
+std::vector<UInt> threshold_limits(UInt max_sum) {
+    std::vector<UInt> limits;
+    for (ull128 t : thresholds)
+        limits.push_back(static_cast<UInt>(std::min<ull128>(t, max_sum)));
+    return limits;
+}
+
+// Function to record an accepted triplet in the thread's threshold histogram and export buffer
+template <typename UInt>
+inline void record_triplet(PaddedCounter* counter, const std::vector<UInt>& limits, UInt a, UInt b, UInt c) {
+    if (!limits.empty()) {
+        size_t bucket = std::lower_bound(limits.begin(), limits.end(), a + b + c) - limits.begin();
+        counter->histogram[bucket]++;
+    }
+    if (counter->writer)
+        counter->writer->append(static_cast<uint64_t>(a), static_cast<uint64_t>(b), static_cast<uint64_t>(c));
+}
 
-        if (start_a > end_a)
+// Function to build the base primes and their 8k + 5 roots for the segmented sieve
+void build_base_primes(ull limit) {
+    limit = std::max<ull>(limit, 3);
+    std::vector<bool> composite(limit + 1, false);
+    base_primes.clear();
+    base_roots.clear();
+    for (ull p = 2; p <= limit; ++p) {
+        if (composite[p])
             continue;
+        base_primes.push_back(static_cast<uint32_t>(p));
+        for (ull m = p * p; m <= limit; m += p)
+            composite[m] = true;
+
+        // 8k + 5 is odd, otherwise k = -5 / 8 (mod p)
+        ull root = p;
+        if (p != 2) {
+            ull inv2 = (p + 1) / 2;
+            ull inv8 = inv2 * inv2 % p * inv2 % p;
+            root = (p - 5 % p) * inv8 % p;
+        }
+        base_roots.push_back(static_cast<uint32_t>(root));
+    }
+}
+
+// Per-thread scratch space holding the factorizations of k + 1 and 8k + 5 for one block of k
+struct SieveBlock {
+    std::vector<ull> rem_m, rem_q;          // Cofactors left after dividing out the base primes
+    std::vector<uint32_t> prime_m, prime_q; // MAX_SIEVE_FACTORS slots per k
+    std::vector<uint8_t> exp_m, exp_q;
+    std::vector<uint8_t> count_m, count_q;
+
+    SieveBlock()
+        : rem_m(SIEVE_BLOCK), rem_q(SIEVE_BLOCK),
+          prime_m(SIEVE_BLOCK * MAX_SIEVE_FACTORS), prime_q(SIEVE_BLOCK * MAX_SIEVE_FACTORS),
+          exp_m(SIEVE_BLOCK * MAX_SIEVE_FACTORS), exp_q(SIEVE_BLOCK * MAX_SIEVE_FACTORS),
+          count_m(SIEVE_BLOCK), count_q(SIEVE_BLOCK) {}
+};
+
+// Divide every base prime out of the values rem[i] with i = first (mod p), recording prime and exponent
+static void sieve_progression(std::vector<ull>& rem, std::vector<uint32_t>& primes, std::vector<uint8_t>& exps,
+                              std::vector<uint8_t>& counts, ull k0, size_t len, uint32_t p, ull root) {
+    size_t i = static_cast<size_t>((root + p - k0 % p) % p);
+    for (; i < len; i += p) {
+        uint8_t e = 0;
+        do {
+            rem[i] /= p;
+            ++e;
+        } while (rem[i] % p == 0);
+        EULER251_STAT(hot_stats.trial_divisions += e);
+        size_t slot = i * MAX_SIEVE_FACTORS + counts[i]++;
+        primes[slot] = p;
+        exps[slot] = e;
+    }
+}
+
+// Function to factor k + 1 and 8k + 5 for all k in [k0, k0 + len) with the base primes
+void sieve_block(SieveBlock& blk, ull k0, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        blk.rem_m[i] = k0 + i + 1;
+        blk.rem_q[i] = 8 * (k0 + i) + 5;
+        blk.count_m[i] = 0;
+        blk.count_q[i] = 0;
+    }
+    for (size_t j = 0; j < base_primes.size(); ++j) {
+        uint32_t p = base_primes[j];
+        sieve_progression(blk.rem_m, blk.prime_m, blk.exp_m, blk.count_m, k0, len, p, p - 1);
+        if (p != 2)
+            sieve_progression(blk.rem_q, blk.prime_q, blk.exp_q, blk.count_q, k0, len, p, base_roots[j]);
+    }
+}
+
+// Function to merge the factor lists of k + 1 and 8k + 5 into the factorization of N_div = (k + 1)^2 (8k + 5).
+// Both lists are ascending and can only share the prime 3.
+template <typename UInt>
+void merge_factor_lists(const BasicFactorList<UInt>& m, const BasicFactorList<UInt>& q, BasicFactorList<UInt>& factors) {
+    factors.clear();
+    size_t x = 0, y = 0;
+    while (x < m.size || y < q.size) {
+        if (y == q.size || (x < m.size && m.prime[x] < q.prime[y])) {
+            factors.add(m.prime[x], 2 * m.exp[x]);
+            ++x;
+        } else if (x == m.size || q.prime[y] < m.prime[x]) {
+            factors.add(q.prime[y], q.exp[y]);
+            ++y;
+        } else {
+            factors.add(m.prime[x], 2 * m.exp[x] + q.exp[y]);
+            ++x;
+            ++y;
+        }
+    }
+}
+
+// Function to merge the sieved factors of k + 1 and 8k + 5 for entry i of a block
+template <typename UInt>
+void merge_block_factors(const SieveBlock& blk, size_t i, BasicFactorList<UInt>& factors) {
+    // The leftover cofactor is a prime larger than every base prime, so it goes last
+    BasicFactorList<UInt> m, q;
+    for (size_t j = 0; j < blk.count_m[i]; ++j)
+        m.add(blk.prime_m[i * MAX_SIEVE_FACTORS + j], blk.exp_m[i * MAX_SIEVE_FACTORS + j]);
+    if (blk.rem_m[i] > 1)
+        m.add(blk.rem_m[i], 1);
+    for (size_t j = 0; j < blk.count_q[i]; ++j)
+        q.add(blk.prime_q[i * MAX_SIEVE_FACTORS + j], blk.exp_q[i * MAX_SIEVE_FACTORS + j]);
+    if (blk.rem_q[i] > 1)
+        q.add(blk.rem_q[i], 1);
+    merge_factor_lists(m, q, factors);
+}
+
+// Function to factor N_div for a single a = 3k + 2 with Pollard-rho on k + 1 and 8k + 5
+void factor_point(ull128 a, FactorList& factors) {
+    ull128 k = (a - 2) / 3;
+    FactorList m, q;
+    factorize_rho(k + 1, m);
+    factorize_rho(8 * k + 5, q);
+    merge_factor_lists(m, q, factors);
+}
+
+// Function to find Cardano Triplets for a in [3 k_lo + 2, 3 k_hi + 2] with UInt-wide arithmetic
+template <typename UInt>
+void find_cardano_triplets(ull k_lo, ull k_hi, UInt max_sum, PaddedCounter* counter) {
+    std::vector<BasicFactorList<UInt>> batch(FACTOR_BATCH);
+
+    // Count the pairs for the batch of 'a' starting at 3 k0 + 2, bucketing each a + b + c by
+    // threshold in multi-threshold mode
+    std::vector<UInt> limits = threshold_limits<UInt>(max_sum);
+    auto count_batch = [&](ull k0, size_t len) {
+        EULER251_PHASE(walk_seconds);
+        for (size_t i = 0; i < len; ++i) {
+            UInt a = 3 * static_cast<UInt>(k0 + i) + 2;
+            const BasicFactorList<UInt>& factors = batch[i];
+            EULER251_STAT(hot_stats.values_factored++; hot_stats.distinct_primes[factors.size]++);
+            if (limits.empty() && !counter->writer) {
+                counter->value += generate_bc(factors, max_sum, a);
+                continue;
+            }
+            counter->value += generate_bc(factors, max_sum, a, [&](UInt b, UInt c) {
+                record_triplet(counter, limits, a, b, c);
+            });
+        }
+    };
+
+    if (factor_source == FactorSource::Rho) {
+        FactorList wide;
+        for (ull k0 = k_lo; k0 <= k_hi; k0 += FACTOR_BATCH) {
+            size_t len = static_cast<size_t>(std::min<ull>(FACTOR_BATCH, k_hi - k0 + 1));
+            {
+                EULER251_PHASE(factor_seconds);
+                for (size_t i = 0; i < len; ++i) {
+                    factor_point(3 * static_cast<ull128>(k0 + i) + 2, wide);
+                    batch[i].clear();
+                    for (size_t j = 0; j < wide.size; ++j)
+                        batch[i].add(static_cast<UInt>(wide.prime[j]), wide.exp[j]);
+                }
+            }
+            count_batch(k0, len);
+        }
+        return;
+    }
+
+    SieveBlock blk;
+    for (ull k0 = k_lo; k0 <= k_hi; k0 += SIEVE_BLOCK) {
+        size_t len = static_cast<size_t>(std::min<ull>(SIEVE_BLOCK, k_hi - k0 + 1));
+        {
+            EULER251_PHASE(factor_seconds);
+            sieve_block(blk, k0, len);
+        }
+
+        // Merge the sieved factors a batch at a time, then generate and count the (b, c) pairs
+        for (size_t i0 = 0; i0 < len; i0 += FACTOR_BATCH) {
+            size_t batch_len = std::min(FACTOR_BATCH, len - i0);
+            {
+                EULER251_PHASE(factor_seconds);
+                for (size_t i = 0; i < batch_len; ++i)
+                    merge_block_factors(blk, i0 + i, batch[i]);
+            }
+            count_batch(k0 + i0, batch_len);
+        }
+    }
+}
 
-        threads.emplace_back(find_cardano_triplets, start_a, end_a, max_sum);
+// Function to find Cardano Triplets in a given range of 'a', running the 64-bit kernels
+// wherever the factors and max_sum fit and the 128-bit ones above that
+void find_cardano_triplets(ull128 start_a, ull128 end_a, ull128 max_sum, PaddedCounter* counter) {
+    // a = 3k + 2, so the range maps to k in [k_lo, k_hi]
+    ull k_lo = static_cast<ull>((start_a - 2) / 3);
+    ull k_hi = static_cast<ull>((end_a - 2) / 3);
+
+    if (max_sum <= UINT64_MAX && k_lo <= K_MAX_64) {
+        find_cardano_triplets<uint64_t>(k_lo, std::min(k_hi, K_MAX_64), static_cast<uint64_t>(max_sum), counter);
+        k_lo = K_MAX_64 + 1;
+    }
+    if (k_lo <= k_hi)
+        find_cardano_triplets<ull128>(k_lo, k_hi, max_sum, counter);
+}
+
+// ---------------------------------------------------------------------------
+// Work-stealing scheduler. The k range is cut into chunks whose estimated cost is a
+// fixed fraction of the cost still left, so chunks shrink toward the expensive end.
+// Each thread owns a queue of chunks; when it runs dry it steals from the back of
+// another thread's queue.
+// ---------------------------------------------------------------------------
+
+const ull MIN_CHUNK = 1024;        // Smallest chunk, in values of k; keeps per-block sieve setup amortized
+const unsigned CHUNKS_PER_THREAD = 8;
+const long double COST_EXPONENT = 0.25L; // Estimated cost of one k grows like (k + 1)^0.25
+
+// A contiguous run of k values (a = 3k + 2)
+struct Chunk {
+    ull k_lo, k_hi;
+};
+
+// Per-thread chunk queue: the owner pops from the front, thieves take from the back
+struct alignas(64) WorkQueue {
+    std::mutex lock;
+    std::deque<Chunk> chunks;
+};
+
+// Per-thread load balance report
+struct alignas(64) WorkerStats {
+    double busy_seconds = 0;
+    double idle_seconds = 0;
+    ull chunks_run = 0;
+    ull chunks_stolen = 0;
+};
+
+// Function to cut [0, k_max] into chunks and deal them round-robin to the thread queues
+void build_chunks(ull k_max, std::vector<WorkQueue>& queues) {
+    // Cumulative cost model C(k) = (k + 1)^(1 + COST_EXPONENT)
+    auto cost = [](long double k) { return std::pow(k + 1, 1 + COST_EXPONENT); };
+    auto inverse_cost = [](long double c) { return std::pow(c, 1 / (1 + COST_EXPONENT)) - 1; };
+
+    size_t next_queue = 0;
+    long double total = cost(k_max);
+    for (ull k = 0; k <= k_max;) {
+        long double remaining = total - cost(static_cast<long double>(k) - 1);
+        long double target = cost(static_cast<long double>(k) - 1) + remaining / (CHUNKS_PER_THREAD * queues.size());
+        ull k_end = static_cast<ull>(inverse_cost(target));
+        k_end = std::max(k_end, k + MIN_CHUNK - 1);
+        k_end = std::min(k_end, k_max);
+
+        queues[next_queue].chunks.push_back({k, k_end});
+        next_queue = (next_queue + 1) % queues.size();
+        k = k_end + 1;
     }
+}
+
+// Function to take the next chunk: own queue first, then steal from the others
+bool next_chunk(std::vector<WorkQueue>& queues, size_t self, Chunk& chunk, bool& stolen) {
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if (!queues[self].chunks.empty()) {
+            chunk = queues[self].chunks.front();
+            queues[self].chunks.pop_front();
+            stolen = false;
+            return true;
+        }
+    }
+    for (size_t step = 1; step < queues.size(); ++step) {
+        WorkQueue& victim = queues[(self + step) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.chunks.empty()) {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            stolen = true;
+            return true;
+        }
+    }
+    return false; // Chunks are never added back, so every queue being empty means we are done
+}
 
+// Thread body: run chunks until none are left anywhere
+void run_worker(std::vector<WorkQueue>& queues, size_t self, ull128 max_sum, PaddedCounter* counter, WorkerStats* stats) {
+    counter->histogram.assign(thresholds.size(), 0); // Allocated here so no two threads' bins share a cache line
+    Chunk chunk;
+    bool stolen;
+    while (next_chunk(queues, self, chunk, stolen)) {
+        auto chunk_start = std::chrono::steady_clock::now();
+        find_cardano_triplets(3 * static_cast<ull128>(chunk.k_lo) + 2, 3 * static_cast<ull128>(chunk.k_hi) + 2, max_sum, counter);
+        std::chrono::duration<double> busy = std::chrono::steady_clock::now() - chunk_start;
+
+        stats->busy_seconds += busy.count();
+        stats->chunks_run++;
+        if (stolen)
+            stats->chunks_stolen++;
+    }
+    publish_hot_stats();
+}
+
+// ---------------------------------------------------------------------------
+// Square-divisor engine. Every solution of b^2 c = (k + 1)^2 (8k + 5) is uniquely
+//   b = q (k + 1) / d,  c = d^2 (8k + 5) / q^2   with  q^2 | 8k + 5,  d | k + 1,
+// where 3 may divide q or d but not both: gcd(k + 1, 8k + 5) | 3, and this picks one
+// of the representations of the shared factor 3. For a fixed (q, d) the valid k form
+// one residue class mod d q^2 and a + b + c grows linearly with k, so only the k that
+// actually fit under max_sum are visited instead of every a up to max_sum.
+// ---------------------------------------------------------------------------
+
+const ull Q_BATCH = 16; // Odd q values handed to a thread at a time
+
+// Modular inverse of x mod m, for gcd(x, m) = 1
+static ull inverse_mod(ull x, ull m) {
+    long long old_r = static_cast<long long>(x % m), r = static_cast<long long>(m);
+    long long old_s = 1, s = 0;
+    while (r != 0) {
+        long long quotient = old_r / r;
+        std::swap(old_r, r);
+        r -= quotient * old_r;
+        std::swap(old_s, s);
+        s -= quotient * old_s;
+    }
+    return static_cast<ull>((old_s % static_cast<long long>(m) + static_cast<long long>(m)) % static_cast<long long>(m));
+}
+
+// Function to visit every triplet with b^2 c's square part split as (q, d) for q in [q_lo, q_hi] (odd)
+void square_engine_range(ull q_lo, ull q_hi, ull max_sum, PaddedCounter* counter) {
+    const ull128 L = max_sum;
+    std::vector<ull> limits = threshold_limits<ull>(max_sum);
+
+    EULER251_PHASE(walk_seconds);
+    for (ull q = q_lo; q <= q_hi; q += 2) {
+        ull128 m = static_cast<ull128>(q) * q;
+        // Smallest k with q^2 | 8k + 5; 8k + 5 is then m, 3m, 5m or 7m
+        ull128 t = 0;
+        if (m > 1) {
+            ull128 inv2 = (m + 1) / 2;
+            ull128 inv8 = inv2 * inv2 % m * inv2 % m;
+            t = (m - 5 % m) % m * inv8 % m;
+        }
+
+        for (ull d = 1;; ++d) {
+            // Lower bounds at the smallest k this (q, d) could use; both grow with d
+            ull128 k_low = std::max<ull128>(t, d - 1);
+            ull128 bound = 3 * k_low + 2 + static_cast<ull128>(d) * d * (8 * k_low + 5) / m;
+            if (bound > L)
+                break;
+            if (bound + q * (k_low + 1) / d > L)
+                continue;
+            if (q % 3 == 0 && d % 3 == 0)
+                continue;
+            if (d > 1 && std::gcd(d, q) != 1)
+                continue; // p | d and p^2 | 8k + 5 forces p = 3, handled above
+
+            // CRT: k = t + m j with k ≡ -1 (mod d)
+            ull j0 = 0;
+            if (d > 1) {
+                ull target = static_cast<ull>((d - 1 - t % d) % d);
+                j0 = static_cast<ull>(static_cast<ull128>(target) * inverse_mod(static_cast<ull>(m % d), d) % d);
+            }
+            ull128 step = m * d;
+            EULER251_STAT(hot_stats.square_pairs++);
+            for (ull128 k = t + m * j0;; k += step) {
+                ull128 a = 3 * k + 2;
+                ull128 b = q * (k + 1) / d;
+                ull128 c = static_cast<ull128>(d) * d * ((8 * k + 5) / m);
+                EULER251_STAT(hot_stats.leaves_visited++);
+                if (a + b + c > L)
+                    break;
+                EULER251_STAT(hot_stats.leaves_accepted++);
+                counter->value++;
+                record_triplet<ull>(counter, limits, static_cast<ull>(a), static_cast<ull>(b), static_cast<ull>(c));
+            }
+        }
+    }
+}
+
+// Thread body for the square-divisor engine: take batches of q until q_max is passed
+void run_square_worker(std::atomic<ull>* next_q, ull q_max, ull max_sum, PaddedCounter* counter, WorkerStats* stats) {
+    counter->histogram.assign(thresholds.size(), 0);
+    while (true) {
+        ull q_lo = next_q->fetch_add(2 * Q_BATCH, std::memory_order_relaxed);
+        if (q_lo > q_max)
+            break;
+        auto batch_start = std::chrono::steady_clock::now();
+        square_engine_range(q_lo, std::min(q_lo + 2 * (Q_BATCH - 1), q_max), max_sum, counter);
+        std::chrono::duration<double> busy = std::chrono::steady_clock::now() - batch_start;
+        stats->busy_seconds += busy.count();
+        stats->chunks_run++;
+    }
+    publish_hot_stats();
+}
+
+// Function to run the chosen engine over every triplet with a + b + c <= max_sum.
+// Results land in the per-thread counters; stats get each thread's busy and idle time.
+void run_sweep(Engine engine, ull128 max_sum, std::vector<PaddedCounter>& counters, std::vector<WorkerStats>& stats) {
+    size_t num_threads = counters.size();
+    std::vector<std::thread> threads;
+    std::vector<std::chrono::steady_clock::time_point> thread_start(num_threads);
+    std::vector<WorkQueue> queues(num_threads);
+    std::atomic<ull> next_q{1};
+
+    // Estimate MAX_A based on max_sum
+    ull128 MAX_A = max_sum; // Conservative estimate
+    if (MAX_A < 2) {
+        for (auto& counter : counters)
+            counter.histogram.assign(thresholds.size(), 0); // No worker runs to allocate them
+        return;
+    }
+
+    if (engine == Engine::Square) {
+        // b + c >= 3 (b^2 c / 4)^(1/3) > 3.77 k and k >= (q^2 - 5) / 8, so q^2 <= 8 max_sum / 6.77 + 5
+        ull q_max = static_cast<ull>(std::sqrt(8 * static_cast<long double>(max_sum) / 6.77L + 5)) + 1;
+        for (size_t i = 0; i < num_threads; ++i) {
+            thread_start[i] = std::chrono::steady_clock::now();
+            threads.emplace_back(run_square_worker, &next_q, q_max, static_cast<ull>(max_sum), &counters[i], &stats[i]);
+        }
+    } else {
+        // Base primes for the segmented sieve cover the largest 8k + 5; sweep_supported()
+        // keeps k_max within K_MAX_64 for the sieve and below 2^64 - 1 for --rho
+        ull k_max = static_cast<ull>((MAX_A - 2) / 3); // Largest k with a = 3k + 2 <= MAX_A
+        if (factor_source == FactorSource::Sieve)
+            build_base_primes(static_cast<ull>(std::sqrt(static_cast<long double>(8 * k_max + 5))) + 1);
+        build_chunks(k_max, queues);
+
+        for (size_t i = 0; i < num_threads; ++i) {
+            thread_start[i] = std::chrono::steady_clock::now();
+            threads.emplace_back(run_worker, std::ref(queues), i, max_sum, &counters[i], &stats[i]);
+        }
+    }
     for (auto& t : threads) {
         t.join();
     }
 
+    // Idle time covers stealing and waiting for the last thread to finish
+    auto finish = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_threads; ++i) {
+        std::chrono::duration<double> alive = finish - thread_start[i];
+        stats[i].idle_seconds = alive.count() - stats[i].busy_seconds;
+    }
+}
+
+// Function to check that a sweep up to max_sum fits the engine's arithmetic, printing why not
+bool sweep_supported(Engine engine, ull128 max_sum) {
+    ull128 k_max = max_sum < 2 ? 0 : (max_sum - 2) / 3;
+    if (engine == Engine::Square) {
+        // The square engine works in 64-bit k and needs headroom for 3k + 2 + b + c
+        if (max_sum >= (static_cast<ull128>(1) << 62)) {
+            std::cerr << "--engine=square needs max_sum < 2^62" << std::endl;
+            return false;
+        }
+    } else if (factor_source == FactorSource::Sieve) {
+        // The sieve computes 8k + 5 and its remainders in 64 bits
+        if (k_max > K_MAX_64) {
+            std::cerr << "The sieve needs max_sum <= " << 3 * static_cast<ull128>(K_MAX_64) + 4 << "; use --rho above that" << std::endl;
+            return false;
+        }
+    } else if (k_max >= UINT64_MAX) { // The chunks walk k in 64 bits
+        std::cerr << "--rho needs max_sum <= " << 3 * static_cast<ull128>(UINT64_MAX - 1) + 4 << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to run both engines on the thresholds (or a default ladder of small limits)
+// and compare every cumulative count; returns true when they agree
+bool cross_check_engines(unsigned int num_threads) {
+    if (thresholds.empty())
+        thresholds = {10, 100, 1000, 5000, 10000, 50000, 100000, 500000, 1000000};
+
+    std::vector<ull> cumulative[2];
+    const Engine engines[2] = {Engine::Divisor, Engine::Square};
+    for (Engine engine : engines)
+        if (!sweep_supported(engine, thresholds.back()))
+            return false;
+    for (int e = 0; e < 2; ++e) {
+        std::vector<PaddedCounter> counters(num_threads);
+        std::vector<WorkerStats> stats(num_threads);
+        run_sweep(engines[e], thresholds.back(), counters, stats);
+
+        ull running = 0;
+        for (size_t i = 0; i < thresholds.size(); ++i) {
+            for (const auto& counter : counters)
+                running += counter.histogram[i];
+            cumulative[e].push_back(running);
+        }
+    }
+
+    bool agree = true;
+    for (size_t i = 0; i < thresholds.size(); ++i) {
+        bool same = cumulative[0][i] == cumulative[1][i];
+        agree &= same;
+        std::cout << "a + b + c <= " << thresholds[i] << ": divisor " << cumulative[0][i] << ", square "
+                  << cumulative[1][i] << (same ? "" : "  MISMATCH") << std::endl;
+    }
+    std::cout << (agree ? "Engines agree" : "Engines disagree") << std::endl;
+    return agree;
+}
+
+// Function to count the Cardano Triplets for a single 'a' (point query)
+ull count_triplets_for_a(ull128 a, ull128 max_sum) {
+    if (a % 3 != 2) // No triplets exist unless a ≡ 2 mod 3
+        return 0;
+    FactorList factors;
+    factor_point(a, factors);
+    return generate_bc(factors, max_sum, a);
+}
+
+// Micro-benchmark of trial division against Pollard-rho on a fixed sample of N_div values
+void benchmark_factorizers() {
+    const int SAMPLES = 64;
+    std::vector<ull128> sample;
+    ull state = 251; // Fixed LCG seed so every run factors the same values
+    for (int i = 0; i < SAMPLES; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        ull128 a = 3 * static_cast<ull128>(1000000 + (state >> 33) % 9000000) + 2;
+        sample.push_back((1 + a) * (1 + a) * (8 * a - 1) / 27);
+    }
+
+    std::vector<FactorList> trial(SAMPLES), rho(SAMPLES);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < SAMPLES; ++i)
+        factorize(sample[i], trial[i]);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < SAMPLES; ++i)
+        factorize_rho(sample[i], rho[i]);
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    int mismatches = 0;
+    for (int i = 0; i < SAMPLES; ++i)
+        if (!(trial[i] == rho[i]))
+            ++mismatches;
+
+    std::chrono::duration<double, std::micro> trial_time = t1 - t0, rho_time = t2 - t1;
+    std::cout << "Factorized " << SAMPLES << " N_div values (a in [3 * 10^6, 3 * 10^7])\n";
+    std::cout << "Trial division: " << trial_time.count() / SAMPLES << " us per value\n";
+    std::cout << "Pollard-rho:    " << rho_time.count() / SAMPLES << " us per value\n";
+    std::cout << "Speedup: " << trial_time.count() / rho_time.count() << "x, mismatches: " << mismatches << std::endl;
+}
+
+// Function to write the published hot-path counters as JSON (no-op without EULER251_STATS)
+void dump_hot_stats() {
+#ifdef EULER251_STATS
+    publish_hot_stats(); // Whatever the main thread did itself
+    const char* path = std::getenv("EULER251_STATS_FILE");
+    std::ofstream out(path ? path : "euler251_stats.json");
+
+    HotPathStats total;
+    out << "{\n  \"threads\": [\n";
+    for (size_t t = 0; t < hot_stats_threads.size(); ++t) {
+        const HotPathStats& s = hot_stats_threads[t];
+        out << "    {\"factor_seconds\": " << s.factor_seconds << ", \"walk_seconds\": " << s.walk_seconds
+            << ", \"trial_divisions\": " << s.trial_divisions << ", \"values_factored\": " << s.values_factored
+            << ", \"leaves_visited\": " << s.leaves_visited << ", \"leaves_accepted\": " << s.leaves_accepted
+            << ", \"branches_pruned\": " << s.branches_pruned << ", \"square_pairs\": " << s.square_pairs << "}"
+            << (t + 1 < hot_stats_threads.size() ? "," : "") << "\n";
+
+        total.factor_seconds += s.factor_seconds;
+        total.walk_seconds += s.walk_seconds;
+        total.trial_divisions += s.trial_divisions;
+        total.values_factored += s.values_factored;
+        total.leaves_visited += s.leaves_visited;
+        total.leaves_accepted += s.leaves_accepted;
+        total.branches_pruned += s.branches_pruned;
+        total.square_pairs += s.square_pairs;
+        for (size_t i = 0; i <= MAX_FACTORS; ++i)
+            total.distinct_primes[i] += s.distinct_primes[i];
+    }
+    out << "  ],\n  \"total\": {\"factor_seconds\": " << total.factor_seconds
+        << ", \"walk_seconds\": " << total.walk_seconds << ", \"trial_divisions\": " << total.trial_divisions
+        << ", \"values_factored\": " << total.values_factored << ", \"leaves_visited\": " << total.leaves_visited
+        << ", \"leaves_accepted\": " << total.leaves_accepted << ", \"branches_pruned\": " << total.branches_pruned
+        << ", \"square_pairs\": " << total.square_pairs << "},\n";
+
+    // Trailing empty buckets are left out
+    size_t last = MAX_FACTORS;
+    while (last > 0 && total.distinct_primes[last] == 0)
+        --last;
+    out << "  \"distinct_primes_histogram\": [";
+    for (size_t i = 0; i <= last; ++i)
+        out << total.distinct_primes[i] << (i < last ? ", " : "");
+    out << "]\n}\n";
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    std::atexit(dump_hot_stats);
+
+    std::vector<ull128> point_as;
+    unsigned int num_threads = 0;
+    std::string export_path, verify_path;
+    Engine engine = Engine::Divisor;
+    bool cross_check = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--bench-factor") {
+            benchmark_factorizers();
+            return 0;
+        } else if (arg == "--rho") {
+            factor_source = FactorSource::Rho;
+        } else if (arg == "--engine=square") {
+            engine = Engine::Square;
+        } else if (arg == "--engine=divisor") {
+            engine = Engine::Divisor;
+        } else if (arg == "--cross-check") {
+            cross_check = true;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            num_threads = static_cast<unsigned int>(std::stoul(arg.substr(10)));
+        } else if (arg.rfind("--export=", 0) == 0) {
+            export_path = arg.substr(9);
+        } else if (arg.rfind("--verify=", 0) == 0) {
+            verify_path = arg.substr(9);
+        } else if (arg.rfind("--thresholds=", 0) == 0) {
+            // Comma-separated list of limits on a + b + c
+            std::istringstream list(arg.substr(13));
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                std::istringstream in(item);
+                ull128 t;
+                if (!(in >> t)) {
+                    std::cerr << "Invalid value in " << arg << std::endl;
+                    return 1;
+                }
+                thresholds.push_back(t);
+            }
+            std::sort(thresholds.begin(), thresholds.end());
+            thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+        } else if (arg.rfind("--a=", 0) == 0) {
+            std::istringstream in(arg.substr(4));
+            ull128 a;
+            if (!(in >> a)) {
+                std::cerr << "Invalid value in " << arg << std::endl;
+                return 1;
+            }
+            // 8k + 5 has to fit in 128 bits to be factored
+            if (a >= 2 && (a - 2) / 3 > K_MAX_128) {
+                std::cerr << "--a needs a <= " << 3 * K_MAX_128 + 2 << std::endl;
+                return 1;
+            }
+            point_as.push_back(a);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--engine=divisor|square] [--rho] [--threads=<n>] [--thresholds=<t1,t2,...>]"
+                      << " [--export=<file>] [--cross-check]"
+                      << " [--verify=<file>] [--a=<a>]... [--bench-factor]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Determine the number of hardware threads available
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 4; // Default to 4 if unable to determine
+
+    if (!verify_path.empty())
+        return verify_triplet_file(verify_path, num_threads) == 0 ? 0 : 1;
+    if (cross_check)
+        return cross_check_engines(num_threads) ? 0 : 1;
+
+    if (!thresholds.empty() && !point_as.empty()) {
+        std::cerr << "--thresholds and --a cannot be combined" << std::endl;
+        return 1;
+    }
+    // The square engine never factors N_div, so --rho would silently do nothing
+    if (engine == Engine::Square && factor_source == FactorSource::Rho) {
+        std::cerr << "--rho and --engine=square cannot be combined" << std::endl;
+        return 1;
+    }
+    if (!export_path.empty() && !point_as.empty()) {
+        std::cerr << "--export and --a cannot be combined" << std::endl;
+        return 1;
+    }
+
+    // In multi-threshold mode the sweep runs up to the largest threshold instead of reading stdin
+    ull128 max_sum;
+    if (thresholds.empty()) {
+        std::cout << "Enter the maximum value for (a + b + c): ";
+        std::cin >> max_sum;
+    } else {
+        max_sum = thresholds.back();
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // Point queries factor each requested 'a' on its own instead of sweeping the whole range
+    if (!point_as.empty()) {
+        for (ull128 a : point_as)
+            std::cout << "a = " << a << ": " << count_triplets_for_a(a, max_sum) << " Cardano Triplets" << std::endl;
+
+        std::chrono::duration<double> elapsed_seconds = std::chrono::high_resolution_clock::now() - start_time;
+        std::cout << "Elapsed time: " << elapsed_seconds.count() << " seconds\n";
+        return 0;
+    }
+
+    std::cout << "Number of threads: " << num_threads << std::endl;
+
+    if (!sweep_supported(engine, max_sum))
+        return 1;
+
+    std::vector<PaddedCounter> counters(num_threads);
+
+    // Export mode: records are fixed-width 64-bit, which covers any a, b, c <= max_sum < 2^64
+    TripletFile export_file;
+    std::vector<std::unique_ptr<TripletWriter>> writers;
+    if (!export_path.empty()) {
+        if (max_sum > UINT64_MAX || !export_file.open(export_path, static_cast<uint64_t>(max_sum))) {
+            std::cerr << "Cannot export to " << export_path << std::endl;
+            return 1;
+        }
+        for (auto& counter : counters) {
+            writers.emplace_back(new TripletWriter(&export_file));
+            counter.writer = writers.back().get();
+        }
+    }
+
+    std::vector<WorkerStats> stats(num_threads);
+    run_sweep(engine, max_sum, counters, stats);
+    for (const auto& counter : counters)
+        total_triplet_count += counter.value;
+
+    if (!export_path.empty()) {
+        bool failed = false;
+        for (auto& writer : writers) {
+            writer->flush();
+            failed |= writer->failed();
+        }
+        failed |= !export_file.close();
+        if (failed) {
+            std::cerr << "Writing " << export_path << " failed" << std::endl;
+            return 1;
+        }
+        std::cout << "Exported " << export_file.record_count() << " triplets to " << export_path << std::endl;
+    }
+
     auto end_time = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed_seconds = end_time - start_time;
 
+    double max_busy = 0, sum_busy = 0;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        max_busy = std::max(max_busy, stats[i].busy_seconds);
+        sum_busy += stats[i].busy_seconds;
+        std::cout << "Thread " << i << ": busy " << stats[i].busy_seconds << " s, idle " << stats[i].idle_seconds
+                  << " s, chunks " << stats[i].chunks_run << " (" << stats[i].chunks_stolen << " stolen)\n";
+    }
+    if (sum_busy > 0)
+        std::cout << "Load imbalance (max / mean busy): " << max_busy / (sum_busy / num_threads) << std::endl;
+
+    // Threshold i is answered by the cumulative sum of buckets 0..i
+    ull cumulative = 0;
+    for (size_t i = 0; i < thresholds.size(); ++i) {
+        for (const auto& counter : counters)
+            cumulative += counter.histogram[i];
+        std::cout << "Cardano Triplets with a + b + c <= " << thresholds[i] << ": " << cumulative << std::endl;
+    }
+
     std::cout << "Total Cardano Triplets: " << total_triplet_count << std::endl;
     std::cout << "Elapsed time: " << elapsed_seconds.count() << " seconds\n";
 
     return 0;
-}
\ No newline at end of file
+}
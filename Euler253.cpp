@@ -6,67 +6,986 @@
 #include <omp.h>
 #include <chrono>
 #include <iomanip>
-#include <thread> // For std::this_thread::get_id
+#include <array>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <immintrin.h>
+#include <unordered_map>
+#include <memory>
+#ifndef EULER253_NO_EXACT // -DEULER253_NO_EXACT builds the Monte Carlo modes without Boost
+#include <boost/multiprecision/cpp_int.hpp> // Exact counts of placement orders
+#endif
+#include "Random123/philox.h" // Counter-based streams, one per trial
+#include "Euler253.hpp"
 
-int main() {
-    const int num_pieces = 40; // Number of pieces
-    const long long num_simulations = 100000000000LL; // Number of simulations
 
-    long long total_max_segments = 0;
+// Reference kernel: place the pieces in order and return the largest number of segments seen
+template <int N>
+int max_segments_reference(const int* pieces) {
+    std::vector<bool> placed(N + 2, false);
+    int segments = 0;
+    int max_segments = 0;
 
-    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int j = 0; j < N; ++j) {
+        int piece = pieces[j];
+        placed[piece] = true;
+
+        if (placed[piece - 1] && placed[piece + 1]) {
+            segments--;
+        } else if (!placed[piece - 1] && !placed[piece + 1]) {
+            segments++;
+        }
+
+        max_segments = std::max(max_segments, segments);
+    }
+    return max_segments;
+}
+
+// Bitboard kernel: 'placed' is a Board<N>, one or two words. A new piece adds a
+// segment with no placed neighbour, joins two with both, and extends one otherwise,
+// so segments += 1 - left - right without branching.
+template <int N>
+inline int max_segments_bitboard(const int* pieces) {
+    Board<N> placed;
+    int segments = 0;
+    int max_segments = 0;
+
+    for (int j = 0; j < N; ++j) {
+        int piece = pieces[j];
+        segments += 1 - placed.neighbours(piece);
+        placed.place(piece);
+        max_segments = std::max(max_segments, segments);
+    }
+    return max_segments;
+}
+
+// Function to run both kernels on the same random permutations and count disagreements
+template <int N>
+long long check_kernels(long long num_permutations) {
+    std::mt19937_64 rng(253);
+    std::array<int, N> pieces;
+    long long mismatches = 0;
+    for (long long i = 0; i < num_permutations; ++i) {
+        std::iota(pieces.begin(), pieces.end(), 1);
+        std::shuffle(pieces.begin(), pieces.end(), rng);
+        if (max_segments_reference<N>(pieces.data()) != max_segments_bitboard<N>(pieces.data()))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+// ---------------------------------------------------------------------------
+// Trial streams: trial i draws only from Philox4x32-10 keyed by the experiment
+// seed, with counter (i, block). Which thread, chunk or kernel runs a trial never
+// changes its draws, and the totals are integer sums, so a given seed gives
+// bit-identical results for any thread count and any kernel.
+//
+// A trial draws its permutation with Fisher-Yates from the back; the piece that
+// lands at position j is final at that point, so it is placed right away (the
+// placement order is the reversed permutation, which is just as uniform). Swap k
+// (j = N - 1 - k) uses 32-bit word k % 4 of block k / 4 and maps it to
+// [0, j] by multiply-shift, with a bias below (j + 1) / 2^32 <= 100 / 2^32, about
+// 2.3 * 10^-8 at the largest --pieces, far under the Monte Carlo noise. The vector
+// kernels run one trial per lane and keep the pieces in a lane-interleaved array,
+// perm[pos * LANES + lane].
+//
+// A trial stops drawing as soon as max_segments_settled() shows the pieces still
+// to come cannot beat its maximum (a vector batch stops once all its lanes have);
+// the skipped draws are never used, so the totals are the same as for a full walk.
+//
+// Everything below is templated on the number of pieces N, so the placement loop
+// has a constant trip count and the board is a Board<N>. main() dispatches
+// --pieces to one of the instantiations in dispatch_pieces(). The vector kernels
+// keep one 64-bit board per lane and exist for N <= 62; larger boards use the
+// scalar kernel.
+// ---------------------------------------------------------------------------
+
+const int PHILOX_ROUNDS = 10;
+
+// Exact distribution of max_segments over a run of trials; the moments derive from it
+template <int N>
+using TrialHistogram = SegmentHistogram<N>;
+
+typedef r123::Philox4x32_R<PHILOX_ROUNDS> TrialRng;
+
+TrialRng::key_type make_trial_key(uint64_t seed) {
+    TrialRng::key_type key = {{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)}};
+    return key;
+}
+
+// Scalar kernel: runs 'count' trials starting at trial 'first'
+template <int N>
+TrialHistogram<N> run_trials_scalar(TrialRng::key_type key, long long first, long long count) {
+    TrialRng philox;
+    std::array<int, N> perm;
+    TrialHistogram<N> histogram;
+    for (long long i = first; i < first + count; ++i) {
+        std::iota(perm.begin(), perm.end(), 1);
+        TrialRng::ctr_type ctr = {{static_cast<uint32_t>(i), static_cast<uint32_t>(static_cast<uint64_t>(i) >> 32), 0, 0}};
+        TrialRng::ctr_type draw = {{}};
+        Board<N> placed;
+        int segments = 0, max_segments = 0;
+
+        for (int j = N - 1; j >= 0; --j) {
+            int k = N - 1 - j;
+            if (k % 4 == 0) {
+                ctr[2] = k / 4;
+                draw = philox(ctr, key);
+            }
+            int r = static_cast<int>((static_cast<uint64_t>(draw[k % 4]) * (j + 1)) >> 32);
+            int piece = perm[r];
+            perm[r] = perm[j];
 
-    #pragma omp parallel
-    {
-        // Combine thread ID and random_device for seeding
-        std::random_device rd;
-        unsigned long long seed = rd() ^ 
-                                  (std::hash<std::thread::id>()(std::this_thread::get_id()) + 
-                                  std::chrono::system_clock::now().time_since_epoch().count());
+            segments += 1 - placed.neighbours(piece);
+            placed.place(piece);
+            max_segments = std::max(max_segments, segments);
+            if (max_segments_settled(segments, j, max_segments))
+                break;
+        }
+        histogram.add(max_segments);
+    }
+    return histogram;
+}
 
-        std::mt19937_64 rng(seed);
-        std::uniform_int_distribution<int> dist(1, num_pieces);
+// Philox4x32-10 on four lanes, one 32-bit word per 64-bit lane so _mm256_mul_epu32
+// gives the full product: counter words c0..c3 in, output words out0..out3
+__attribute__((target("avx2")))
+static inline void philox_avx2(__m256i c0, __m256i c1, __m256i c2, __m256i c3, TrialRng::key_type key, __m256i out[4]) {
+    const __m256i m0 = _mm256_set1_epi64x(0xD2511F53), m1 = _mm256_set1_epi64x(0xCD9E8D57);
+    const __m256i low = _mm256_set1_epi64x(0xFFFFFFFF);
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+        __m256i p0 = _mm256_mul_epu32(m0, c0);
+        __m256i p1 = _mm256_mul_epu32(m1, c2);
+        __m256i n0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), c1), _mm256_set1_epi64x(k0));
+        __m256i n2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), c3), _mm256_set1_epi64x(k1));
+        c1 = _mm256_and_si256(p1, low);
+        c3 = _mm256_and_si256(p0, low);
+        c0 = n0;
+        c2 = n2;
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
 
-        long long local_total = 0;
+// AVX2 kernel: 8 trials per batch as two 4-lane halves, trials first, first + 1, ...
+template <int N>
+__attribute__((target("avx2")))
+TrialHistogram<N> run_batches_avx2(TrialRng::key_type key, long long first, long long batches) {
+    static_assert(N + 1 < 64, "one 64-bit board per lane");
+    const int LANES = 8, H = 2;
+    alignas(32) int64_t perm[N * LANES];
+    alignas(32) int64_t idx_out[4], val_out[4], lane_max[4];
+    // Lane-major bin counts: a batch's lanes hit distinct slots, so their increments do not
+    // wait on each other the way eight adds to one popular histogram bin do
+    alignas(32) int64_t lane_counts[TrialHistogram<N>::BINS * LANES] = {};
 
-        #pragma omp for
-        for (long long i = 0; i < num_simulations; ++i) {
-            std::vector<int> pieces(num_pieces);
-            std::iota(pieces.begin(), pieces.end(), 1);
-            std::shuffle(pieces.begin(), pieces.end(), rng);
+    TrialHistogram<N> histogram;
+    __m256i lane_id[H];
+    for (int h = 0; h < H; ++h) {
+        lane_id[h] = _mm256_setr_epi64x(4 * h, 4 * h + 1, 4 * h + 2, 4 * h + 3);
+    }
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i low = _mm256_set1_epi64x(0xFFFFFFFF);
 
-            std::vector<bool> placed(num_pieces + 1, false);
-            int segments = 0;
-            int max_segments = 0;
+    for (long long batch = 0; batch < batches; ++batch) {
+        for (int pos = 0; pos < N; ++pos)
+            for (int h = 0; h < H; ++h)
+                _mm256_store_si256(reinterpret_cast<__m256i*>(&perm[pos * LANES + 4 * h]), _mm256_set1_epi64x(pos + 1));
 
-            for (int j = 0; j < num_pieces; ++j) {
-                int piece = pieces[j];
-                placed[piece] = true;
+        __m256i placed[H], segments[H], max_segments[H], trial[H], draw[H][4];
+        for (int h = 0; h < H; ++h) {
+            placed[h] = segments[h] = max_segments[h] = _mm256_setzero_si256();
+            trial[h] = _mm256_add_epi64(_mm256_set1_epi64x(first + batch * LANES), lane_id[h]);
+        }
+
+        for (int j = N - 1; j >= 0; --j) {
+            int k = N - 1 - j;
+            __m256i bound = _mm256_set1_epi64x(j + 1);
+            for (int h = 0; h < H; ++h) {
+                if (k % 4 == 0)
+                    philox_avx2(_mm256_and_si256(trial[h], low), _mm256_srli_epi64(trial[h], 32),
+                                _mm256_set1_epi64x(k / 4), zero, key, draw[h]);
+                __m256i r = _mm256_srli_epi64(_mm256_mul_epu32(draw[h][k % 4], bound), 32);
+                __m256i idx = _mm256_add_epi64(_mm256_slli_epi64(r, 3), lane_id[h]);
+                __m256i piece = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(perm), idx, 8);
+                __m256i at_j = _mm256_load_si256(reinterpret_cast<const __m256i*>(&perm[j * LANES + 4 * h]));
 
-                if (placed[piece - 1] && placed[piece + 1]) {
-                    segments--;
-                } else if (!placed[piece - 1] && !placed[piece + 1]) {
-                    segments++;
-                }
+                // perm[r] = perm[j]; AVX2 has no scatter
+                _mm256_store_si256(reinterpret_cast<__m256i*>(idx_out), idx);
+                _mm256_store_si256(reinterpret_cast<__m256i*>(val_out), at_j);
+                for (int l = 0; l < 4; ++l)
+                    perm[idx_out[l]] = val_out[l];
 
-                max_segments = std::max(max_segments, segments);
+                __m256i left = _mm256_and_si256(_mm256_srlv_epi64(placed[h], _mm256_sub_epi64(piece, one)), one);
+                __m256i right = _mm256_and_si256(_mm256_srlv_epi64(placed[h], _mm256_add_epi64(piece, one)), one);
+                segments[h] = _mm256_sub_epi64(_mm256_add_epi64(segments[h], one), _mm256_add_epi64(left, right));
+                placed[h] = _mm256_or_si256(placed[h], _mm256_sllv_epi64(one, piece));
+                __m256i greater = _mm256_cmpgt_epi64(segments[h], max_segments[h]);
+                max_segments[h] = _mm256_blendv_epi8(max_segments[h], segments[h], greater);
             }
+            if (3 * j <= 2 * N) { // Settling needs 2 * max >= unplaced, so not in the first third
+                __m256i unplaced = _mm256_set1_epi64x(j), open = zero;
+                for (int h = 0; h < H; ++h)
+                    open = _mm256_or_si256(open, _mm256_cmpgt_epi64(_mm256_add_epi64(segments[h], unplaced),
+                                                                    _mm256_slli_epi64(max_segments[h], 1)));
+                if (_mm256_testz_si256(open, open))
+                    break;
+            }
+        }
+        for (int h = 0; h < H; ++h) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lane_max), max_segments[h]);
+            for (int l = 0; l < 4; ++l)
+                ++lane_counts[lane_max[l] * LANES + 4 * h + l];
+        }
+    }
+    for (int m = 0; m < TrialHistogram<N>::BINS; ++m)
+        for (int l = 0; l < LANES; ++l)
+            histogram.count[m] += lane_counts[m * LANES + l];
+    return histogram;
+}
+
+// Philox4x32-10 on eight lanes, laid out as in philox_avx2
+__attribute__((target("avx512f")))
+static inline void philox_avx512(__m512i c0, __m512i c1, __m512i c2, __m512i c3, TrialRng::key_type key, __m512i out[4]) {
+    const __m512i m0 = _mm512_set1_epi64(0xD2511F53), m1 = _mm512_set1_epi64(0xCD9E8D57);
+    const __m512i low = _mm512_set1_epi64(0xFFFFFFFF);
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+        __m512i p0 = _mm512_mul_epu32(m0, c0);
+        __m512i p1 = _mm512_mul_epu32(m1, c2);
+        __m512i n0 = _mm512_xor_si512(_mm512_xor_si512(_mm512_srli_epi64(p1, 32), c1), _mm512_set1_epi64(k0));
+        __m512i n2 = _mm512_xor_si512(_mm512_xor_si512(_mm512_srli_epi64(p0, 32), c3), _mm512_set1_epi64(k1));
+        c1 = _mm512_and_si512(p1, low);
+        c3 = _mm512_and_si512(p0, low);
+        c0 = n0;
+        c2 = n2;
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// AVX-512 kernel: 16 trials per batch as two 8-lane halves
+template <int N>
+__attribute__((target("avx512f")))
+TrialHistogram<N> run_batches_avx512(TrialRng::key_type key, long long first, long long batches) {
+    static_assert(N + 1 < 64, "one 64-bit board per lane");
+    const int LANES = 16, H = 2;
+    alignas(64) int64_t perm[N * LANES];
+    alignas(64) int64_t lane_max[8];
+    alignas(64) int64_t lane_counts[TrialHistogram<N>::BINS * LANES] = {}; // Lane-major, as in run_batches_avx2
+
+    TrialHistogram<N> histogram;
+    __m512i lane_id[H];
+    for (int h = 0; h < H; ++h) {
+        lane_id[h] = _mm512_setr_epi64(8 * h, 8 * h + 1, 8 * h + 2, 8 * h + 3, 8 * h + 4, 8 * h + 5, 8 * h + 6, 8 * h + 7);
+    }
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i low = _mm512_set1_epi64(0xFFFFFFFF);
+
+    for (long long batch = 0; batch < batches; ++batch) {
+        for (int pos = 0; pos < N; ++pos)
+            for (int h = 0; h < H; ++h)
+                _mm512_store_si512(&perm[pos * LANES + 8 * h], _mm512_set1_epi64(pos + 1));
 
-            local_total += max_segments;
+        __m512i placed[H], segments[H], max_segments[H], trial[H], draw[H][4];
+        for (int h = 0; h < H; ++h) {
+            placed[h] = segments[h] = max_segments[h] = _mm512_setzero_si512();
+            trial[h] = _mm512_add_epi64(_mm512_set1_epi64(first + batch * LANES), lane_id[h]);
         }
 
-        #pragma omp atomic
-        total_max_segments += local_total;
+        for (int j = N - 1; j >= 0; --j) {
+            int k = N - 1 - j;
+            __m512i bound = _mm512_set1_epi64(j + 1);
+            for (int h = 0; h < H; ++h) {
+                if (k % 4 == 0)
+                    philox_avx512(_mm512_and_si512(trial[h], low), _mm512_srli_epi64(trial[h], 32),
+                                  _mm512_set1_epi64(k / 4), zero, key, draw[h]);
+                __m512i r = _mm512_srli_epi64(_mm512_mul_epu32(draw[h][k % 4], bound), 32);
+                __m512i idx = _mm512_add_epi64(_mm512_slli_epi64(r, 4), lane_id[h]);
+                __m512i piece = _mm512_i64gather_epi64(idx, perm, 8);
+                __m512i at_j = _mm512_load_si512(&perm[j * LANES + 8 * h]);
+                _mm512_i64scatter_epi64(perm, idx, at_j, 8); // perm[r] = perm[j]
+
+                __m512i left = _mm512_and_si512(_mm512_srlv_epi64(placed[h], _mm512_sub_epi64(piece, one)), one);
+                __m512i right = _mm512_and_si512(_mm512_srlv_epi64(placed[h], _mm512_add_epi64(piece, one)), one);
+                segments[h] = _mm512_sub_epi64(_mm512_add_epi64(segments[h], one), _mm512_add_epi64(left, right));
+                placed[h] = _mm512_or_si512(placed[h], _mm512_sllv_epi64(one, piece));
+                max_segments[h] = _mm512_max_epi64(max_segments[h], segments[h]);
+            }
+            if (3 * j <= 2 * N) { // Settling needs 2 * max >= unplaced, so not in the first third
+                __m512i unplaced = _mm512_set1_epi64(j);
+                __mmask8 open = 0;
+                for (int h = 0; h < H; ++h)
+                    open |= _mm512_cmpgt_epi64_mask(_mm512_add_epi64(segments[h], unplaced), _mm512_slli_epi64(max_segments[h], 1));
+                if (open == 0)
+                    break;
+            }
+        }
+        for (int h = 0; h < H; ++h) {
+            _mm512_store_si512(lane_max, max_segments[h]);
+            for (int l = 0; l < 8; ++l)
+                ++lane_counts[lane_max[l] * LANES + 8 * h + l];
+        }
     }
+    for (int m = 0; m < TrialHistogram<N>::BINS; ++m)
+        for (int l = 0; l < LANES; ++l)
+            histogram.count[m] += lane_counts[m * LANES + l];
+    return histogram;
+}
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> elapsed = end_time - start_time;
+enum class Kernel { Scalar, Avx2, Avx512 };
 
-    double average_max_segments = static_cast<double>(total_max_segments) / num_simulations;
+// Function to pick the widest kernel this CPU supports
+Kernel detect_kernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return Kernel::Avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return Kernel::Avx2;
+    return Kernel::Scalar;
+}
+
+int kernel_lanes(Kernel kernel) {
+    return kernel == Kernel::Avx512 ? 16 : kernel == Kernel::Avx2 ? 8 : 1;
+}
+
+const char* kernel_name(Kernel kernel) {
+    return kernel == Kernel::Avx512 ? "avx512" : kernel == Kernel::Avx2 ? "avx2" : "scalar";
+}
+
+// Function to run trials first .. first + count - 1 on the calling thread: whole batches on the
+// vector kernel, the rest on the scalar one (boards too wide for a vector lane run scalar only)
+template <int N>
+TrialHistogram<N> run_trials(Kernel kernel, TrialRng::key_type key, long long first, long long count) {
+    int lanes = kernel_lanes(kernel);
+    long long batches = count / lanes;
+    TrialHistogram<N> histogram;
+    if constexpr (N + 1 < 64) {
+        if (kernel == Kernel::Avx512)
+            histogram = run_batches_avx512<N>(key, first, batches);
+        else if (kernel == Kernel::Avx2)
+            histogram = run_batches_avx2<N>(key, first, batches);
+        else
+            batches = 0;
+    } else {
+        batches = 0;
+    }
+    histogram.merge(run_trials_scalar<N>(key, first + batches * lanes, count - batches * lanes));
+    return histogram;
+}
 
+// The run_chunk of run_rounds() for the experiment 'seed': trial i draws from Philox(seed, i)
+// whichever thread or kernel runs it, so a run depends only on the seed and the limits
+template <int N>
+struct KernelTrials {
+    Kernel kernel;
+    TrialRng::key_type key;
+
+    KernelTrials(Kernel kernel, uint64_t seed) : kernel(kernel), key(make_trial_key(seed)) {}
+
+    void operator()(int, long long first, long long count, TrialHistogram<N>& histogram) const {
+        histogram.merge(run_trials<N>(kernel, key, first, count));
+    }
+};
+
+// Function to time every kernel this CPU supports on the same trials; the totals must agree exactly.
+// With an active 'placement' each kernel is followed by its per-socket report.
+template <int N>
+void benchmark_kernels(uint64_t seed, long long num_simulations, ThreadPlacement* placement = nullptr) {
+    Kernel best = N + 1 < 64 ? detect_kernel() : Kernel::Scalar;
     std::cout << std::fixed << std::setprecision(6);
-    std::cout << "Average maximum number of segments: " << average_max_segments << std::endl;
+    for (Kernel kernel : {Kernel::Scalar, Kernel::Avx2, Kernel::Avx512}) {
+        if (kernel_lanes(kernel) > kernel_lanes(best))
+            break;
+        auto start = std::chrono::high_resolution_clock::now();
+        long long total = run_rounds<N>(num_simulations, 0.0, 1.96, nullptr, placement, KernelTrials<N>(kernel, seed)).sum();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        std::cout << std::setw(7) << kernel_name(kernel) << ": " << std::setprecision(3)
+                  << num_simulations / elapsed.count() / 1e6 << " M simulations/s, total " << total
+                  << ", average " << std::setprecision(6) << static_cast<double>(total) / num_simulations << std::endl;
+        if (placement && placement->active()) {
+            placement->report(std::cout, elapsed.count());
+            placement->reset_counts();
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Variance-reduced estimators (--estimator=...), scalar only. Sample unit u draws
+// its placement order from the same Philox stream as trial u above; each unit
+// reports integer sums, so totals stay exact and thread-count independent.
+//   plain       one trial per unit, the baseline
+//   antithetic  a unit is an order and its reverse (two simulations)
+//   stratified  unit u takes the first k placed pieces from stratum u mod S, where
+//               S = 40 * 39 * ... (k factors) and all strata are equally likely;
+//               the rest of the order is random. Needs at least S units so that
+//               every stratum is sampled (the first round of units covers them all)
+//   control     X = max_segments with control Y = sum of the segment counts after
+//               every step, whose mean is known exactly: after m of n pieces
+//               E[segments] = m (n - m + 1) / n, summing to (n + 1)(n + 2) / 6
+// The effective-sample-size gain is the plain per-simulation variance (measured on
+// the same draws) over the estimator's variance times its simulations per unit.
+// ---------------------------------------------------------------------------
+
+enum class Estimator { Plain, Antithetic, Stratified, Control };
+
+const char* estimator_name(Estimator estimator) {
+    switch (estimator) {
+    case Estimator::Antithetic: return "antithetic";
+    case Estimator::Stratified: return "stratified";
+    case Estimator::Control: return "control";
+    default: return "plain";
+    }
+}
+
+// Exact sums over sample units: X is the first (or only) max_segments of a unit, Y the
+// antithetic partner or the control statistic
+struct EstimatorSums {
+    long long n = 0;
+    long long sx = 0, sxx = 0, sy = 0, syy = 0, sxy = 0;
+    std::vector<long long> stratum_n, stratum_sum; // Stratified only
+
+    void merge(const EstimatorSums& other) {
+        n += other.n;
+        sx += other.sx;
+        sxx += other.sxx;
+        sy += other.sy;
+        syy += other.syy;
+        sxy += other.sxy;
+        if (stratum_n.size() < other.stratum_n.size()) {
+            stratum_n.resize(other.stratum_n.size());
+            stratum_sum.resize(other.stratum_sum.size());
+        }
+        for (size_t s = 0; s < other.stratum_n.size(); ++s) {
+            stratum_n[s] += other.stratum_n[s];
+            stratum_sum[s] += other.stratum_sum[s];
+        }
+    }
+};
+
+// Function to get the sample covariance of a and b from exact sums over n samples
+static double sample_covariance(long long n, long long sa, long long sb, long long sab) {
+    if (n < 2)
+        return 0.0;
+    __int128 scaled = static_cast<__int128>(sab) * n - static_cast<__int128>(sa) * sb;
+    return static_cast<double>(scaled) / (static_cast<double>(n) * (n - 1));
+}
+
+template <int N>
+long long num_strata(int depth) {
+    long long strata = 1;
+    for (int k = 0; k < depth; ++k)
+        strata *= N - k;
+    return strata;
+}
+
+// Function to draw unit u's placement order as run_trials_scalar does; the first 'fixed'
+// swap indices come from the digits of 'stratum' (radix N, N - 1, ...)
+template <int N>
+static void draw_order(TrialRng::key_type key, long long u, int fixed, long long stratum, int* order) {
+    TrialRng philox;
+    int perm[N];
+    std::iota(perm, perm + N, 1);
+    TrialRng::ctr_type ctr = {{static_cast<uint32_t>(u), static_cast<uint32_t>(static_cast<uint64_t>(u) >> 32), 0, 0}};
+    TrialRng::ctr_type draw = {{}};
+    for (int j = N - 1; j >= 0; --j) {
+        int k = N - 1 - j;
+        if (k % 4 == 0) {
+            ctr[2] = k / 4;
+            draw = philox(ctr, key);
+        }
+        int r;
+        if (k < fixed) {
+            r = static_cast<int>(stratum % (j + 1));
+            stratum /= j + 1;
+        } else {
+            r = static_cast<int>((static_cast<uint64_t>(draw[k % 4]) * (j + 1)) >> 32);
+        }
+        order[k] = perm[r];
+        perm[r] = perm[j];
+    }
+}
+
+// Function to place the pieces in order (backwards if 'reverse') and return max_segments;
+// 'area' receives the sum of the segment counts after every step
+template <int N>
+static inline int walk_order(const int* order, bool reverse, int& area) {
+    Board<N> placed;
+    int segments = 0, max_segments = 0;
+    area = 0;
+    for (int k = 0; k < N; ++k) {
+        int piece = order[reverse ? N - 1 - k : k];
+        segments += 1 - placed.neighbours(piece);
+        placed.place(piece);
+        max_segments = std::max(max_segments, segments);
+        area += segments;
+    }
+    return max_segments;
+}
+
+// Function to run sample units first .. first + count - 1 into 'sums'
+template <int N>
+static void run_units(Estimator estimator, int depth, TrialRng::key_type key, long long first, long long count, EstimatorSums& sums) {
+    long long strata = num_strata<N>(depth);
+    int order[N];
+    for (long long u = first; u < first + count; ++u) {
+        long long stratum = u % strata;
+        draw_order<N>(key, u, estimator == Estimator::Stratified ? depth : 0, stratum, order);
+        int area;
+        long long x = walk_order<N>(order, false, area), y = 0;
+        if (estimator == Estimator::Antithetic) {
+            int unused;
+            y = walk_order<N>(order, true, unused);
+        } else if (estimator == Estimator::Control) {
+            y = area;
+        } else if (estimator == Estimator::Stratified) {
+            sums.stratum_n[stratum]++;
+            sums.stratum_sum[stratum] += x;
+        }
+        sums.n++;
+        sums.sx += x;
+        sums.sxx += x * x;
+        sums.sy += y;
+        sums.syy += y * y;
+        sums.sxy += x * y;
+    }
+}
+
+struct EstimateResult {
+    long long simulations = 0;
+    double mean = 0.0;
+    double variance = 0.0;       // Variance of 'mean'
+    double plain_variance = 0.0; // Per-simulation variance of max_segments
+    double ess_gain = 1.0;
+};
+
+// Function to turn exact unit sums into the estimate, its variance and the ESS gain
+template <int N>
+EstimateResult evaluate_estimator(Estimator estimator, const EstimatorSums& sums) {
+    EstimateResult result;
+    long long n = sums.n;
+    if (n < 2)
+        return result;
+    double var_x = sample_covariance(n, sums.sx, sums.sx, sums.sxx);
+    result.simulations = n;
+    result.mean = static_cast<double>(sums.sx) / n;
+    result.plain_variance = var_x;
+    result.variance = var_x / n;
+
+    if (estimator == Estimator::Antithetic) {
+        double var_y = sample_covariance(n, sums.sy, sums.sy, sums.syy);
+        double cov = sample_covariance(n, sums.sx, sums.sy, sums.sxy);
+        result.simulations = 2 * n;
+        result.mean = static_cast<double>(sums.sx + sums.sy) / (2 * n);
+        result.plain_variance = sample_covariance(2 * n, sums.sx + sums.sy, sums.sx + sums.sy, sums.sxx + sums.syy);
+        result.variance = (var_x + var_y + 2 * cov) / (4.0 * n);
+    } else if (estimator == Estimator::Control) {
+        double var_y = sample_covariance(n, sums.sy, sums.sy, sums.syy);
+        double cov = sample_covariance(n, sums.sx, sums.sy, sums.sxy);
+        double mu_y = (N + 1) * (N + 2) / 6.0;
+        double beta = var_y > 0 ? cov / var_y : 0.0;
+        result.mean -= beta * (static_cast<double>(sums.sy) / n - mu_y);
+        result.variance = var_y > 0 ? (var_x - cov * cov / var_y) / n : var_x / n;
+    } else if (estimator == Estimator::Stratified) {
+        // Equal-weight mean over the strata, with the pooled within-stratum variance; the
+        // caller runs at least one unit per stratum, so every stratum is seen
+        double mean = 0.0, between = 0.0;
+        long long seen = 0;
+        for (size_t s = 0; s < sums.stratum_n.size(); ++s) {
+            if (sums.stratum_n[s] == 0)
+                continue;
+            double stratum_sum = static_cast<double>(sums.stratum_sum[s]);
+            mean += stratum_sum / sums.stratum_n[s];
+            between += stratum_sum * stratum_sum / sums.stratum_n[s];
+            ++seen;
+        }
+        result.mean = mean / seen;
+        if (n > seen)
+            result.variance = (static_cast<double>(sums.sxx) - between) / (n - seen) / n;
+    }
+    if (result.variance > 0)
+        result.ess_gain = result.plain_variance / (result.variance * result.simulations);
+    return result;
+}
+
+// Function to run sample units in rounds on all threads, with the same stopping rule as run_rounds()
+// but counting at most max_simulations simulations; 'placement', if given, pins the workers as there
+template <int N>
+EstimateResult simulate_estimator(Estimator estimator, int depth, uint64_t seed, long long max_simulations,
+                                  double target_half_width = 0.0, double z = 1.96, ThreadPlacement* placement = nullptr) {
+    const long long CHUNK_UNITS = 16384;
+    const long long ROUND_CHUNKS = 256;
+    TrialRng::key_type key = make_trial_key(seed);
+    long long max_units = estimator == Estimator::Antithetic ? max_simulations / 2 : max_simulations;
+    long long chunks = (max_units + CHUNK_UNITS - 1) / CHUNK_UNITS;
+    size_t strata = estimator == Estimator::Stratified ? static_cast<size_t>(num_strata<N>(depth)) : 0;
+    EstimatorSums total;
+    total.stratum_n.assign(strata, 0);
+    total.stratum_sum.assign(strata, 0);
+    EstimateResult result;
+
+    for (long long round = 0; round < chunks; round += ROUND_CHUNKS) {
+        long long round_chunks = std::min(ROUND_CHUNKS, chunks - round);
+        std::vector<std::unique_ptr<EstimatorSums>> thread_sums(omp_get_max_threads());
+
+        #pragma omp parallel
+        {
+            int tid = omp_get_thread_num();
+            if (placement)
+                placement->pin(tid);
+            thread_sums[tid].reset(new EstimatorSums()); // Allocated by the worker, after pinning
+            EstimatorSums& local = *thread_sums[tid];
+            local.stratum_n.assign(strata, 0);
+            local.stratum_sum.assign(strata, 0);
+            #pragma omp for schedule(dynamic)
+            for (long long c = 0; c < round_chunks; ++c) {
+                long long first = (round + c) * CHUNK_UNITS;
+                long long count = std::min(CHUNK_UNITS, max_units - first);
+                run_units<N>(estimator, depth, key, first, count, local);
+                if (placement)
+                    placement->count(tid, estimator == Estimator::Antithetic ? 2 * count : count);
+            }
+        }
+
+        for (const auto& part : thread_sums)
+            if (part)
+                total.merge(*part);
+        result = evaluate_estimator<N>(estimator, total);
+        if (target_half_width > 0 && z * std::sqrt(result.variance) <= target_half_width)
+            break;
+    }
+    return result;
+}
+
+#ifndef EULER253_NO_EXACT
+// ---------------------------------------------------------------------------
+// Exact mode: dynamic programming over every placement order. After the first piece
+// the board is described by its gaps of unplaced positions: the two edge gaps (one
+// side is the border) and the interior gaps between segments, whose count is
+// segments - 1. A DP state is (running max, edge gaps, sorted interior gaps) and
+// holds how many placement orders reach it. Each layer adds one piece, so after
+// n layers the counts add up to n! and the expected maximum is sum(M * count) / n!.
+// Needs Boost.Multiprecision for the counts; -DEULER253_NO_EXACT leaves it out.
+// ---------------------------------------------------------------------------
+
+using boost::multiprecision::cpp_int;
+using boost::multiprecision::cpp_rational;
+
+// State key bytes: [running max, smaller edge gap, larger edge gap, interior gaps ascending]
+typedef std::string DpKey;
+typedef std::unordered_map<DpKey, cpp_int> DpLayer;
+
+static DpKey make_key(int max_segments, int edge_a, int edge_b, std::vector<int>& interior) {
+    std::sort(interior.begin(), interior.end());
+    DpKey key;
+    key.reserve(3 + interior.size());
+    key.push_back(static_cast<char>(max_segments));
+    key.push_back(static_cast<char>(std::min(edge_a, edge_b)));
+    key.push_back(static_cast<char>(std::max(edge_a, edge_b)));
+    for (int g : interior)
+        key.push_back(static_cast<char>(g));
+    return key;
+}
+
+// Function to add every successor of one state (reached by 'count' orders) to 'next'
+static void expand_state(const DpKey& key, const cpp_int& count, DpLayer& next) {
+    int max_segments = static_cast<unsigned char>(key[0]);
+    int edges[2] = {static_cast<unsigned char>(key[1]), static_cast<unsigned char>(key[2])};
+    std::vector<int> interior;
+    for (size_t i = 3; i < key.size(); ++i)
+        interior.push_back(static_cast<unsigned char>(key[i]));
+    int segments = static_cast<int>(interior.size()) + 1;
+
+    std::vector<int> gaps;
+    auto emit = [&](int new_segments, int edge_a, int edge_b, std::vector<int>& new_interior, long long ways) {
+        next[make_key(std::max(max_segments, new_segments), edge_a, edge_b, new_interior)] += count * ways;
+    };
+
+    // A piece in an edge gap of length E at distance i from the border (1 <= i <= E)
+    for (int side = 0; side < 2; ++side) {
+        int e = edges[side], other = edges[1 - side];
+        if (e == 0)
+            continue;
+        gaps = interior; // i = E touches the segment: it just grows
+        emit(segments, e - 1, other, gaps, 1);
+        for (int i = 1; i < e; ++i) { // Otherwise a new segment splits the gap
+            gaps = interior;
+            gaps.push_back(e - i);
+            emit(segments + 1, i - 1, other, gaps, 1);
+        }
+    }
+
+    // A piece in an interior gap of length G; equal gaps give identical successors
+    for (size_t g = 0; g < interior.size();) {
+        size_t same = g;
+        while (same < interior.size() && interior[same] == interior[g])
+            ++same;
+        long long multiplicity = static_cast<long long>(same - g);
+        int len = interior[g];
+
+        gaps = interior;
+        gaps.erase(gaps.begin() + g);
+        if (len == 1) { // Fills the gap and joins two segments
+            emit(segments - 1, edges[0], edges[1], gaps, multiplicity);
+        } else {
+            std::vector<int> shrunk = gaps; // Either end extends a segment
+            shrunk.push_back(len - 1);
+            emit(segments, edges[0], edges[1], shrunk, 2 * multiplicity);
+            for (int i = 2; i < len; ++i) { // Anywhere else starts a new segment
+                std::vector<int> split = gaps;
+                split.push_back(i - 1);
+                split.push_back(len - i);
+                emit(segments + 1, edges[0], edges[1], split, multiplicity);
+            }
+        }
+        g = same;
+    }
+}
+
+// Function to compute the exact distribution of the maximum segment count for n pieces:
+// distribution[m] = number of the n! placement orders whose maximum is m
+std::vector<cpp_int> exact_distribution(int n) {
+    // The current layer is kept as the per-thread partitions of the previous merge
+    std::vector<DpLayer> layer(1);
+    for (int first = 1; first <= n; ++first) {
+        std::vector<int> none;
+        layer[0][make_key(1, first - 1, n - first, none)] += 1;
+    }
+
+    for (int placed = 1; placed < n; ++placed) {
+        std::vector<std::pair<DpKey, cpp_int>> frontier;
+        for (auto& part : layer)
+            frontier.insert(frontier.end(), part.begin(), part.end());
+
+        // Each thread expands a slice of the frontier into per-owner partitions, then
+        // thread t merges partition t of every thread, so no map is ever shared. The
+        // partitions follow the team OpenMP actually gives, which may be smaller than asked.
+        std::vector<std::vector<DpLayer>> partial;
+        std::vector<DpLayer> merged;
+        #pragma omp parallel
+        {
+            int tid = omp_get_thread_num();
+            int team = omp_get_num_threads();
+            #pragma omp single
+            {
+                partial.assign(team, std::vector<DpLayer>(team));
+                merged.assign(team, DpLayer());
+            } // Implicit barrier: every thread sees the partitions
+
+            DpLayer local;
+            #pragma omp for schedule(dynamic, 64)
+            for (size_t i = 0; i < frontier.size(); ++i)
+                expand_state(frontier[i].first, frontier[i].second, local);
+
+            std::hash<DpKey> hasher;
+            for (auto& entry : local)
+                partial[tid][hasher(entry.first) % team][entry.first] += entry.second;
+
+            #pragma omp barrier
+            for (int t = 0; t < team; ++t)
+                for (auto& entry : partial[t][tid])
+                    merged[tid][entry.first] += entry.second;
+        }
+        layer.swap(merged);
+    }
+
+    std::vector<cpp_int> distribution(n + 2, 0);
+    for (auto& part : layer)
+        for (auto& entry : part)
+            distribution[static_cast<unsigned char>(entry.first[0])] += entry.second;
+    return distribution;
+}
+
+// Function to get the same distribution by walking all n! orders (small n only)
+std::vector<cpp_int> brute_force_distribution(int n) {
+    std::vector<cpp_int> distribution(n + 2, 0);
+    std::vector<int> pieces(n);
+    std::iota(pieces.begin(), pieces.end(), 1);
+    do {
+        uint64_t placed = 0;
+        int segments = 0, max_segments = 0;
+        for (int piece : pieces) {
+            segments += 1 - static_cast<int>((placed >> (piece - 1)) & 1) - static_cast<int>((placed >> (piece + 1)) & 1);
+            placed |= uint64_t(1) << piece;
+            max_segments = std::max(max_segments, segments);
+        }
+        distribution[max_segments] += 1;
+    } while (std::next_permutation(pieces.begin(), pieces.end()));
+    return distribution;
+}
+
+// Function to print the exact expected maximum for n pieces as a fraction and in decimal
+void run_exact(int n) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    std::vector<cpp_int> distribution = exact_distribution(n);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+
+    cpp_int orders = 0, weighted = 0;
+    for (size_t m = 0; m < distribution.size(); ++m) {
+        orders += distribution[m];
+        weighted += distribution[m] * m;
+    }
+    cpp_rational expected(weighted, orders);
+
+    std::cout << "Distribution of the maximum number of segments for " << n << " pieces:" << std::endl;
+    for (size_t m = 0; m < distribution.size(); ++m)
+        if (distribution[m] != 0)
+            std::cout << "  M = " << m << ": " << distribution[m] << std::endl;
+
+    // Decimal expansion to 12 places, rounded half up
+    const int DIGITS = 12;
+    cpp_int scale = boost::multiprecision::pow(cpp_int(10), DIGITS);
+    cpp_int scaled = (numerator(expected) * scale * 2 + denominator(expected)) / (denominator(expected) * 2);
+    std::string digits = cpp_int(scaled % scale + scale).str().substr(1);
+    std::cout << "Expected maximum: " << expected << " = " << scaled / scale << "." << digits << std::endl;
+
+    if (n <= 10) {
+        bool same = brute_force_distribution(n) == distribution;
+        std::cout << "Brute force over all " << n << "! orders: " << (same ? "matches" : "MISMATCH") << std::endl;
+    }
     std::cout << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
+}
+#endif // EULER253_NO_EXACT
+
+// Command-line settings of a Monte Carlo run, on top of the shared ones
+struct RunOptions : RunSettings {
+    Kernel kernel = detect_kernel();
+    bool bench = false;
+    bool check_kernel = false;
+    bool use_estimator = false; // Set by --estimator; runs the scalar sample-unit path
+    Estimator estimator = Estimator::Plain;
+    int strata_depth = 2; // First pieces fixed by the stratum
+
+    RunOptions() {
+        seed = std::random_device()(); // Printed below so the run can be repeated with --seed
+    }
+};
+
+// Function to run the Monte Carlo modes for a board of N pieces
+template <int N>
+int run_monte_carlo(RunOptions options) {
+    if (N + 1 >= 64)
+        options.kernel = Kernel::Scalar;
+
+    if (options.check_kernel) {
+        const long long num_permutations = 10000000;
+        long long mismatches = check_kernels<N>(num_permutations);
+        std::cout << "Bitboard vs reference kernel on " << num_permutations << " permutations of " << N << " pieces: "
+                  << mismatches << " mismatches" << std::endl;
+        return mismatches == 0 ? 0 : 1;
+    }
+
+    if (options.bench) {
+        ThreadPlacement placement(options.placement, omp_get_max_threads());
+        benchmark_kernels<N>(options.seed, options.num_simulations, &placement);
+        return 0;
+    }
+
+    double z = normal_quantile(options.confidence);
+    double confidence = options.confidence;
+
+    if (options.use_estimator) {
+        Estimator estimator = options.estimator;
+        // The variance needs two units, and an antithetic unit is two simulations
+        long long min_simulations = estimator == Estimator::Antithetic ? 4 : 2;
+        if (options.num_simulations < min_simulations) {
+            std::cerr << "--estimator=" << estimator_name(estimator) << " needs --simulations >= " << min_simulations
+                      << " (two sample units)" << std::endl;
+            return 1;
+        }
+        // With fewer units than strata only a contiguous block of strata would be seen
+        if (estimator == Estimator::Stratified && options.num_simulations < num_strata<N>(options.strata_depth)) {
+            std::cerr << "--estimator=stratified needs --simulations >= " << num_strata<N>(options.strata_depth)
+                      << " (one per stratum) at --strata-depth=" << options.strata_depth << std::endl;
+            return 1;
+        }
+        std::cout << "Estimator: " << estimator_name(estimator);
+        if (estimator == Estimator::Stratified)
+            std::cout << " (" << num_strata<N>(options.strata_depth) << " strata on the first " << options.strata_depth << " pieces)";
+        std::cout << std::endl << "Pieces: " << N << std::endl << "Seed: " << options.seed << std::endl;
+
+        ThreadPlacement placement(options.placement, omp_get_max_threads());
+        auto start_time = std::chrono::high_resolution_clock::now();
+        EstimateResult estimate = simulate_estimator<N>(estimator, options.strata_depth, options.seed, options.num_simulations,
+                                                        options.target_half_width, z, &placement);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+
+        std::cout << "Simulations used: " << estimate.simulations << std::endl;
+        std::cout << std::fixed << std::setprecision(6);
+        std::cout << "Average maximum number of segments: " << estimate.mean << std::endl;
+        std::cout << std::setprecision(2) << confidence * 100 << "% confidence half-width: " << std::scientific
+                  << std::setprecision(3) << z * std::sqrt(estimate.variance) << std::fixed << std::endl;
+        std::cout << "Effective sample size gain: " << std::setprecision(3) << estimate.ess_gain << "x ("
+                  << std::setprecision(0) << estimate.ess_gain * estimate.simulations << " plain simulations)" << std::endl;
+        std::cout << std::setprecision(6) << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
+        if (placement.active())
+            placement.report(std::cout, elapsed.count());
+        return 0;
+    }
+
+    std::cout << "Kernel: " << kernel_name(options.kernel) << std::endl;
+    std::cout << "Pieces: " << N << std::endl;
+    std::cout << "Seed: " << options.seed << std::endl;
+    return run_and_report<N>(options, KernelTrials<N>(options.kernel, options.seed));
+}
+
+int main(int argc, char* argv[]) {
+    RunOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (parse_run_setting(arg, options))
+            continue; // --simulations, --seed, --pieces and the rest of the shared settings
+        if (arg == "--check-kernel") {
+            options.check_kernel = true;
+        } else if (arg == "--exact" || arg.rfind("--exact=", 0) == 0) {
+#ifdef EULER253_NO_EXACT
+            std::cerr << "--exact needs Boost.Multiprecision; this build used -DEULER253_NO_EXACT" << std::endl;
+            return 1;
+#else
+            int n = arg == "--exact" ? num_pieces : std::stoi(arg.substr(8));
+            if (n < 1 || n > 62) {
+                std::cerr << "--exact supports 1 to 62 pieces" << std::endl;
+                return 1;
+            }
+            run_exact(n);
+            return 0;
+#endif
+        } else if (arg == "--bench") {
+            options.bench = true;
+        } else if (arg == "--estimator=plain" || arg == "--estimator=antithetic" || arg == "--estimator=stratified" || arg == "--estimator=control") {
+            options.use_estimator = true;
+            options.estimator = arg == "--estimator=antithetic" ? Estimator::Antithetic
+                              : arg == "--estimator=stratified" ? Estimator::Stratified
+                              : arg == "--estimator=control"    ? Estimator::Control
+                                                                : Estimator::Plain;
+        } else if (arg.rfind("--strata-depth=", 0) == 0 && std::stoi(arg.substr(15)) >= 1 && std::stoi(arg.substr(15)) <= 3) {
+            options.strata_depth = std::stoi(arg.substr(15));
+        } else if (arg == "--kernel=scalar") {
+            options.kernel = Kernel::Scalar;
+        } else if (arg == "--kernel=avx2" && kernel_lanes(detect_kernel()) >= 8) {
+            options.kernel = Kernel::Avx2;
+        } else if (arg == "--kernel=avx512" && kernel_lanes(detect_kernel()) >= 16) {
+            options.kernel = Kernel::Avx512;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " " << run_settings_usage() << " [--kernel=scalar|avx2|avx512] [--bench] [--check-kernel]"
+                      << " [--exact[=<pieces>]] [--estimator=plain|antithetic|stratified|control] [--strata-depth=1..3]"
+                      << " (a --kernel the CPU lacks is rejected)" << std::endl;
+            return 1;
+        }
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return dispatch_pieces(options.pieces, [&](auto pieces) { return run_monte_carlo<decltype(pieces)::value>(options); });
+}
@@ -0,0 +1,581 @@
+// Shared pieces of the Euler 253 Monte Carlo programs (Euler253.cpp, Euler253Random123.cpp)
+#ifndef EULER253_HPP
+#define EULER253_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+#include <sched.h> // sched_setaffinity for ThreadPlacement
+#ifndef EULER253_NO_TELEMETRY
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// Mean and variance of a run, built from the exact integer sums of a SegmentHistogram;
+// threads only add counts to their own histograms, so no thread ever shares one.
+struct RunningStats {
+    long long count = 0;
+    double mean = 0.0;
+    double m2 = 0.0; // Sum of squared deviations from the mean
+
+    // Stats of 'n' samples given their exact integer sum and sum of squares
+    static RunningStats from_sums(long long n, long long sum, long long sum_sq) {
+        RunningStats stats;
+        if (n > 0) {
+            stats.count = n;
+            stats.mean = static_cast<double>(sum) / n;
+            // sum_sq * n - sum^2 can exceed 64 bits, so it is formed in 128 bits
+            __int128 scaled = static_cast<__int128>(sum_sq) * n - static_cast<__int128>(sum) * sum;
+            stats.m2 = static_cast<double>(scaled) / n;
+        }
+        return stats;
+    }
+
+    double variance() const {
+        return count > 1 ? m2 / (count - 1) : 0.0;
+    }
+
+    // Half-width of the normal confidence interval for the mean at quantile z
+    double half_width(double z) const {
+        return count > 1 ? z * std::sqrt(variance() / count) : INFINITY;
+    }
+};
+
+// Function to find the two-sided normal quantile z for a confidence level in (0, 1)
+inline double normal_quantile(double confidence) {
+    double lo = 0.0, hi = 40.0;
+    for (int i = 0; i < 200; ++i) { // erf(z / sqrt(2)) = confidence, by bisection
+        double mid = 0.5 * (lo + hi);
+        if (std::erf(mid / std::sqrt(2.0)) < confidence)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return 0.5 * (lo + hi);
+}
+
+// Placed pieces of an N-piece board, sized at compile time. Up to 63 pieces the board is one
+// 64-bit word with piece p at bit p - 1; the neighbours are read as bit p - 1 of (bits << 1) and
+// bit p of bits, which drop in zeros at both ends, so neither border needs a guard bit.
+template <int N, bool Wide = (N > 63)>
+struct Board {
+    uint64_t bits = 0;
+
+    // Number of placed neighbours of piece p (0, 1 or 2)
+    int neighbours(int p) const {
+        return static_cast<int>(((bits << 1) >> (p - 1)) & 1) + static_cast<int>((bits >> p) & 1);
+    }
+
+    void place(int p) {
+        bits |= uint64_t(1) << (p - 1);
+    }
+};
+
+// Above 63 pieces: two words with piece p at bit p, bits 0 and N + 1 staying clear
+template <int N>
+struct Board<N, true> {
+    static_assert(N + 1 < 128, "board must fit in two 64-bit words");
+    uint64_t bits[2] = {0, 0};
+
+    int test(int i) const {
+        return static_cast<int>((bits[i >> 6] >> (i & 63)) & 1);
+    }
+
+    int neighbours(int p) const {
+        return test(p - 1) + test(p + 1);
+    }
+
+    void place(int p) {
+        bits[p >> 6] |= uint64_t(1) << (p & 63);
+    }
+};
+
+// Function to tell whether a trial's maximum is settled. With 'segments' now and 'unplaced' pieces
+// left, a later count s' with U' pieces still unplaced obeys s' <= segments + (unplaced - U'), since
+// a piece adds at most one segment, and s' <= U' + 1, since segments are separated by unplaced gaps.
+// Both exceed max_segments only if segments + unplaced > 2 * max_segments.
+inline bool max_segments_settled(int segments, int unplaced, int max_segments) {
+    return segments + unplaced <= 2 * max_segments;
+}
+
+// Exact distribution of max_segments, which never exceeds ceil(pieces / 2), so one bin per value
+// fits in a fixed array. Each thread fills its own and they merge at the end; the moments follow
+// from the integer counts, so the merged result does not depend on how trials were split. It is
+// cache-line aligned so that slots filled by different threads never share a line.
+template <int Pieces>
+struct alignas(64) SegmentHistogram {
+    static const int BINS = Pieces / 2 + 2;
+    std::array<long long, BINS> count{};
+
+    void add(int max_segments) {
+        ++count[max_segments];
+    }
+
+    void merge(const SegmentHistogram& other) {
+        for (int m = 0; m < BINS; ++m)
+            count[m] += other.count[m];
+    }
+
+    long long trials() const {
+        long long n = 0;
+        for (long long c : count)
+            n += c;
+        return n;
+    }
+
+    long long sum() const {
+        long long s = 0;
+        for (int m = 0; m < BINS; ++m)
+            s += count[m] * m;
+        return s;
+    }
+
+    long long sum_sq() const {
+        long long s = 0;
+        for (int m = 0; m < BINS; ++m)
+            s += count[m] * m * m;
+        return s;
+    }
+
+    RunningStats stats() const {
+        return RunningStats::from_sums(trials(), sum(), sum_sq());
+    }
+
+    // Function to write the counts, frequencies and moments as plain text
+    void write(std::ostream& out) const {
+        long long n = trials();
+        if (n == 0)
+            return;
+        double mean = static_cast<double>(sum()) / n;
+        double central[5] = {0.0}; // Central moments 2..4, about the exact mean
+        for (int m = 0; m < BINS; ++m)
+            for (int k = 2; k <= 4; ++k)
+                central[k] += count[m] * std::pow(m - mean, k) / n;
+
+        out << "# max_segments distribution over " << n << " trials\n";
+        out << "# M count frequency\n";
+        for (int m = 0; m < BINS; ++m)
+            if (count[m] != 0)
+                out << m << ' ' << count[m] << ' ' << static_cast<double>(count[m]) / n << '\n';
+        out << "# mean " << mean << "\n";
+        out << "# variance " << stats().variance() << "\n";
+        out << "# skewness " << central[3] / std::pow(central[2], 1.5) << "\n";
+        out << "# excess_kurtosis " << central[4] / (central[2] * central[2]) - 3.0 << "\n";
+    }
+};
+
+// Thread placement for the OpenMP workers (Linux). The CPUs this process may use are grouped by
+// NUMA node (from /sys/devices/system/node) and by socket (physical_package_id), and each worker
+// pins itself with pin() at the top of every parallel region (simulation, estimator and --bench
+// runs alike). Each worker then allocates its own histogram or estimator sums, so they are first
+// touched on its node; the small padded counter slots below are allocated by the master thread.
+//   cores  thread t runs on the t-th CPU, filling node 0 first
+//   nodes  the threads split into one contiguous team per node, each team spread over its node
+// Every worker also counts its trials in a padded slot, and report() sums them per socket.
+enum class Placement { None, Cores, Nodes };
+
+class ThreadPlacement {
+public:
+    ThreadPlacement(Placement mode, int threads) : mode(mode), counters(threads), cpu_of(threads, -1) {
+        if (mode == Placement::None)
+            return;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+
+        std::vector<std::vector<int>> node_cpus;
+        for (int node = 0;; ++node) {
+            std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!list)
+                break;
+            std::string text;
+            std::getline(list, text);
+            node_cpus.push_back(usable_cpus(parse_cpu_list(text), allowed));
+        }
+        if (node_cpus.empty()) { // No NUMA information: one node with every allowed CPU
+            std::vector<int> all;
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                all.push_back(cpu);
+            node_cpus.push_back(usable_cpus(all, allowed));
+        }
+        node_cpus.erase(std::remove_if(node_cpus.begin(), node_cpus.end(), [](const std::vector<int>& c) { return c.empty(); }),
+                        node_cpus.end());
+        if (node_cpus.empty())
+            return;
+
+        if (mode == Placement::Cores) {
+            std::vector<int> ordered;
+            for (const std::vector<int>& cpus : node_cpus)
+                ordered.insert(ordered.end(), cpus.begin(), cpus.end());
+            for (int t = 0; t < threads; ++t)
+                cpu_of[t] = ordered[t % ordered.size()];
+        } else {
+            int nodes = static_cast<int>(node_cpus.size());
+            for (int t = 0; t < threads; ++t) {
+                int node = static_cast<int>(static_cast<long long>(t) * nodes / threads);
+                int first = static_cast<int>((static_cast<long long>(node) * threads + nodes - 1) / nodes);
+                cpu_of[t] = node_cpus[node][(t - first) % node_cpus[node].size()];
+            }
+        }
+    }
+
+    // Function to pin the calling thread, OpenMP thread 'tid', to its CPU; repeated calls are free
+    void pin(int tid) const {
+        thread_local int pinned_cpu = -1;
+        if (tid >= static_cast<int>(cpu_of.size()) || cpu_of[tid] < 0 || pinned_cpu == cpu_of[tid])
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu_of[tid], &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == 0)
+            pinned_cpu = cpu_of[tid];
+    }
+
+    void count(int tid, long long trials) {
+        counters[tid].trials += trials;
+    }
+
+    // Function to zero the trial counts, so the next report() covers only what follows
+    void reset_counts() {
+        for (Counter& counter : counters)
+            counter.trials = 0;
+    }
+
+    bool active() const {
+        return mode != Placement::None;
+    }
+
+    // Function to print the threads, trials and throughput of every socket over 'seconds'
+    void report(std::ostream& out, double seconds) const {
+        std::vector<int> sockets;
+        for (int cpu : cpu_of)
+            sockets.push_back(cpu < 0 ? 0 : socket_of(cpu));
+        std::vector<int> seen = sockets;
+        std::sort(seen.begin(), seen.end());
+        seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+        for (int socket : seen) {
+            long long trials = 0;
+            int threads = 0;
+            for (size_t t = 0; t < sockets.size(); ++t)
+                if (sockets[t] == socket) {
+                    trials += counters[t].trials;
+                    ++threads;
+                }
+            std::ostringstream line;
+            line << "Socket " << socket << ": " << threads << " threads, " << trials << " simulations, "
+                 << std::fixed << std::setprecision(2) << trials / seconds / 1e6 << " M simulations/s";
+            out << line.str() << std::endl;
+        }
+    }
+
+private:
+    struct alignas(64) Counter {
+        long long trials = 0;
+    };
+
+    Placement mode;
+    std::vector<Counter> counters;
+    std::vector<int> cpu_of; // -1: left to the OS
+
+    // Function to expand a sysfs CPU list such as "0-3,8-11"
+    static std::vector<int> parse_cpu_list(const std::string& text) {
+        std::vector<int> cpus;
+        std::stringstream ranges(text);
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            if (range.empty())
+                continue;
+            size_t dash = range.find('-');
+            int lo = std::stoi(range.substr(0, dash));
+            int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+            for (int cpu = lo; cpu <= hi; ++cpu)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    static std::vector<int> usable_cpus(const std::vector<int>& cpus, const cpu_set_t& allowed) {
+        std::vector<int> usable;
+        for (int cpu : cpus)
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                usable.push_back(cpu);
+        return usable;
+    }
+
+    static int socket_of(int cpu) {
+        std::ifstream id("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id");
+        int socket = 0;
+        id >> socket;
+        return socket;
+    }
+};
+
+// Live progress of a long run. Every worker thread owns a cache-line slot that only it writes, with
+// relaxed stores of its cumulative trial count and max_segments sum; a monitor thread reads the slots
+// every 'interval' seconds and prints throughput, per-thread skew, ETA and the running estimate to
+// stderr. Build with -DEULER253_NO_TELEMETRY to compile it out, e.g. for benchmark runs.
+#ifndef EULER253_NO_TELEMETRY
+class Telemetry {
+public:
+    Telemetry(int threads, long long target_trials, double interval_seconds)
+        : slots(threads), target(target_trials), interval(interval_seconds) {
+        if (interval > 0)
+            monitor = std::thread([this] { run(); });
+    }
+
+    ~Telemetry() {
+        stop();
+    }
+
+    // Function to add 'trials' finished trials, whose max_segments add up to 'sum', to slot 'tid'
+    void publish(int tid, long long trials, long long sum) {
+        Slot& slot = slots[tid];
+        slot.trials.store(slot.trials.load(std::memory_order_relaxed) + trials, std::memory_order_relaxed);
+        slot.sum.store(slot.sum.load(std::memory_order_relaxed) + sum, std::memory_order_relaxed);
+    }
+
+    void stop() {
+        if (!monitor.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        monitor.join();
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<long long> trials{0};
+        std::atomic<long long> sum{0};
+    };
+
+    std::vector<Slot> slots;
+    long long target;
+    double interval;
+    std::thread monitor;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void run() {
+        typedef std::chrono::steady_clock clock;
+        auto start = clock::now(), last = start;
+        long long last_done = 0;
+        std::unique_lock<std::mutex> guard(lock);
+        while (!wake.wait_for(guard, std::chrono::duration<double>(interval), [this] { return stopping; })) {
+            long long done = 0, sum = 0, fewest = -1, most = 0;
+            for (const Slot& slot : slots) {
+                long long trials = slot.trials.load(std::memory_order_relaxed);
+                done += trials;
+                sum += slot.sum.load(std::memory_order_relaxed);
+                fewest = fewest < 0 ? trials : std::min(fewest, trials);
+                most = std::max(most, trials);
+            }
+            auto now = clock::now();
+            double rate = (done - last_done) / std::chrono::duration<double>(now - last).count();
+            double skew = done > 0 ? 100.0 * (most - fewest) * slots.size() / done : 0.0;
+            last = now;
+            last_done = done;
+
+            std::ostringstream line; // One write per report, so lines never interleave
+            line << std::fixed << std::setprecision(1) << "[progress] "
+                 << std::chrono::duration<double>(now - start).count() << " s: " << done << " / " << target << " trials ("
+                 << 100.0 * done / target << "%), " << std::setprecision(2) << rate / 1e6 << " M sims/s, skew "
+                 << std::setprecision(1) << skew << "%, ETA ";
+            if (rate > 0)
+                line << (target - done) / rate << " s";
+            else
+                line << "unknown";
+            if (done > 0)
+                line << ", estimate " << std::setprecision(6) << static_cast<double>(sum) / done;
+            std::cerr << line.str() << std::endl;
+        }
+    }
+};
+#else
+class Telemetry {
+public:
+    Telemetry(int, long long, double) {}
+    void publish(int, long long, long long) {}
+    void stop() {}
+};
+#endif
+
+// ---------------------------------------------------------------------------
+// Monte Carlo driver shared by both programs: the settings they both take, the run loop,
+// the report and the dispatch to a compiled-in board size. A program supplies its trials
+// as a callable run_chunk(tid, first, count, histogram) that adds trials first .. first +
+// count - 1 to 'histogram' on thread 'tid'.
+// ---------------------------------------------------------------------------
+
+const int num_pieces = 40; // Default number of pieces; --pieces picks another instantiation
+
+// Board sizes compiled in: the problem's 40, its 10-piece example, and both sides of the
+// one-word / two-word board boundary
+const int instantiated_pieces[] = {10, 20, 40, 63, 64, 100};
+
+// Command-line settings of a run that both programs take
+struct RunSettings {
+    int pieces = num_pieces;
+    uint64_t seed = 0;
+    long long num_simulations = 100000000000LL; // Upper limit on the number of simulations
+    double target_half_width = 0.0; // Stop once the confidence interval is this narrow (0: never)
+    double confidence = 0.95;
+    std::string histogram_path; // Where --histogram writes the distribution of max_segments
+    double progress_interval = 10.0; // Seconds between progress lines on stderr (0: none)
+    Placement placement = Placement::None; // How --placement pins the worker threads
+};
+
+// Function to apply 'arg' to 'settings' if it is one of the shared settings; returns false if it
+// is not, or if its value is out of range
+inline bool parse_run_setting(const std::string& arg, RunSettings& settings) {
+    if (arg.rfind("--simulations=", 0) == 0 && std::stoll(arg.substr(14)) >= 1) {
+        settings.num_simulations = std::stoll(arg.substr(14));
+    } else if (arg.rfind("--half-width=", 0) == 0) {
+        settings.target_half_width = std::stod(arg.substr(13));
+    } else if (arg.rfind("--confidence=", 0) == 0 && std::stod(arg.substr(13)) > 0 && std::stod(arg.substr(13)) < 1) {
+        settings.confidence = std::stod(arg.substr(13));
+    } else if (arg.rfind("--histogram=", 0) == 0) {
+        settings.histogram_path = arg.substr(12);
+    } else if (arg.rfind("--pieces=", 0) == 0) {
+        settings.pieces = std::stoi(arg.substr(9));
+    } else if (arg.rfind("--seed=", 0) == 0) {
+        settings.seed = std::stoull(arg.substr(7));
+    } else if (arg == "--placement=none" || arg == "--placement=cores" || arg == "--placement=nodes") {
+        settings.placement = arg == "--placement=cores" ? Placement::Cores : arg == "--placement=nodes" ? Placement::Nodes : Placement::None;
+    } else if (arg.rfind("--progress=", 0) == 0) {
+        settings.progress_interval = std::stod(arg.substr(11));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Function to list the shared settings for a usage message
+inline std::string run_settings_usage() {
+    std::string pieces;
+    for (int n : instantiated_pieces)
+        pieces += (pieces.empty() ? "" : "|") + std::to_string(n);
+    return "[--simulations=<n>] [--half-width=<h>] [--confidence=<level>] [--seed=<n>] [--pieces=" + pieces +
+           "] [--histogram=<file>] [--progress=<seconds>] [--placement=none|cores|nodes]";
+}
+
+// Function to call run(std::integral_constant<int, N>()) for the compiled-in board size N = pieces
+template <class Run>
+int dispatch_pieces(int pieces, Run&& run) {
+    switch (pieces) {
+    case 10: return run(std::integral_constant<int, 10>());
+    case 20: return run(std::integral_constant<int, 20>());
+    case 40: return run(std::integral_constant<int, 40>());
+    case 63: return run(std::integral_constant<int, 63>());
+    case 64: return run(std::integral_constant<int, 64>());
+    case 100: return run(std::integral_constant<int, 100>());
+    default:
+        std::cerr << "--pieces must be one of";
+        for (int n : instantiated_pieces)
+            std::cerr << ' ' << n;
+        std::cerr << std::endl;
+        return 1;
+    }
+}
+
+// Function to run trials 0, 1, ... on all threads through run_chunk, at most max_simulations of
+// them. The trials go in rounds of 2^22, cut into chunks that OpenMP deals out statically, so
+// with a given thread count every thread runs the same trials each time (what the per-thread
+// streams of the sequential generators need). Each worker pins itself with 'placement', then
+// allocates its own cumulative histogram; after a round the histograms add up to the result
+// (integer counts, so the order does not matter), and the run stops after the first round whose
+// confidence half-width at quantile z is at most target_half_width (0 runs everything). Every
+// chunk is published to 'telemetry' and counted by 'placement' if they are given.
+template <int N, class RunChunk>
+SegmentHistogram<N> run_rounds(long long max_simulations, double target_half_width, double z, Telemetry* telemetry,
+                               ThreadPlacement* placement, RunChunk&& run_chunk) {
+    const long long CHUNK_TRIALS = 1 << 16; // A multiple of every vector kernel's lane count
+    const long long ROUND_TRIALS = 1LL << 22;
+    std::vector<std::unique_ptr<SegmentHistogram<N>>> thread_histograms(omp_get_max_threads());
+    SegmentHistogram<N> histogram;
+
+    for (long long round = 0; round < max_simulations; round += ROUND_TRIALS) {
+        long long round_end = std::min(max_simulations, round + ROUND_TRIALS);
+
+        #pragma omp parallel
+        {
+            int tid = omp_get_thread_num();
+            if (placement)
+                placement->pin(tid);
+            if (!thread_histograms[tid])
+                thread_histograms[tid].reset(new SegmentHistogram<N>());
+            SegmentHistogram<N>& local = *thread_histograms[tid];
+
+            #pragma omp for schedule(static)
+            for (long long first = round; first < round_end; first += CHUNK_TRIALS) {
+                long long count = std::min(CHUNK_TRIALS, round_end - first);
+                long long sum_before = local.sum();
+                run_chunk(tid, first, count, local);
+                if (telemetry)
+                    telemetry->publish(tid, count, local.sum() - sum_before);
+                if (placement)
+                    placement->count(tid, count);
+            }
+        }
+
+        histogram = SegmentHistogram<N>();
+        for (const auto& local : thread_histograms)
+            if (local)
+                histogram.merge(*local);
+        if (target_half_width > 0 && histogram.stats().half_width(z) <= target_half_width)
+            break;
+    }
+    return histogram;
+}
+
+// Function to run a board of N pieces with 'settings' through run_rounds(), with live progress
+// and thread placement, and print the estimate, its confidence half-width, the elapsed time and
+// the per-socket report; --histogram also writes out the distribution
+template <int N, class RunChunk>
+int run_and_report(const RunSettings& settings, RunChunk&& run_chunk) {
+    double z = normal_quantile(settings.confidence);
+    Telemetry telemetry(omp_get_max_threads(), settings.num_simulations, settings.progress_interval);
+    ThreadPlacement placement(settings.placement, omp_get_max_threads());
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    SegmentHistogram<N> histogram = run_rounds<N>(settings.num_simulations, settings.target_half_width, z, &telemetry,
+                                                  &placement, run_chunk);
+    telemetry.stop();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+
+    RunningStats stats = histogram.stats();
+    std::cout << "Simulations used: " << stats.count << std::endl;
+    std::cout << std::fixed << std::setprecision(6);
+    std::cout << "Average maximum number of segments: " << static_cast<double>(histogram.sum()) / stats.count << std::endl;
+    std::cout << std::setprecision(2) << settings.confidence * 100 << "% confidence half-width: " << std::scientific
+              << std::setprecision(3) << stats.half_width(z) << std::fixed << std::setprecision(6) << std::endl;
+    std::cout << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
+    if (placement.active())
+        placement.report(std::cout, elapsed.count());
+
+    if (!settings.histogram_path.empty()) {
+        std::ofstream out(settings.histogram_path);
+        out << std::setprecision(12);
+        histogram.write(out);
+        std::cout << "Distribution written to " << settings.histogram_path << std::endl;
+    }
+    return 0;
+}
+
+#endif // EULER253_HPP
@@ -6,81 +6,477 @@
 #include <chrono>
 #include <iomanip>
 #include <thread>
+#include <string>
+#include <fstream>
+#include <array>
+#include <random>
+#include <memory>
+#include <x86intrin.h> // __rdtsc for the backend benchmark
 #include "Random123/philox.h"  // Include the Random123 Philox header
+#include "Random123/threefry.h"
+#include "Random123/ars.h" // Empty unless AES-NI is enabled at compile time (-maes)
+#include "Random123/uniform.hpp"
+#include "Euler253.hpp"
 
 using namespace r123;  // Use the Random123 namespace
 
-int main() {
-    const int num_pieces = 40; // Number of pieces
-    const long long num_simulations = 100000000000LL; // Number of simulations
+// ---------------------------------------------------------------------------
+// RNG policies. A policy is built once per thread from the experiment seed and the
+// thread id; start(i) positions it at trial i and index(j) returns the Fisher-Yates
+// swap index in [0, j]. Counter-based generators key on the seed and put the trial
+// index i next to the draw counter, so their trials do not depend on the thread that
+// runs them; the sequential generators (mt19937_64, xoshiro512**) keep one stream per
+// thread instead. index() is force-inlined: left to the compiler, the Philox call
+// stays out of line and the run is about 20% slower than the hand-written loop it
+// replaced.
+// ---------------------------------------------------------------------------
 
-    long long total_max_segments = 0;
+// Function to store the 64-bit 'value' in the words of 'words' from 'at' on: two 32-bit words
+// (low first) or one 64-bit word, so no bits of a seed or trial index are dropped
+template <class Words>
+inline void put_u64(Words& words, int at, uint64_t value) {
+    typedef typename Words::value_type word_type;
+    const int BITS = 8 * sizeof(word_type);
+    for (int w = 0; w < 64 / BITS; ++w)
+        words[at + w] = static_cast<word_type>(value >> (BITS * w));
+}
 
-    auto start_time = std::chrono::high_resolution_clock::now();
+// Keying shared by the counter-based policies: the full 64-bit seed in the key, the full
+// 64-bit trial index in the counter words after c[0], which the policy counts with
+template <class CBRNG>
+struct CounterKey {
+    typedef typename CBRNG::ctr_type ctr_type;
+    typedef typename CBRNG::key_type key_type;
+    ctr_type c = {{}};
+    key_type k = {{}};
 
-    #pragma omp parallel
-    {
-        // Get the thread ID to use as part of the counter for Random123
-        unsigned int tid = omp_get_thread_num();
+    explicit CounterKey(uint64_t seed) {
+        put_u64(k, 0, seed);
+    }
 
-        long long local_total = 0;
+    void start(long long i) {
+        c[0] = 0;
+        put_u64(c, 1, static_cast<uint64_t>(i));
+    }
+};
 
-        std::vector<int> pieces(num_pieces);
-        std::vector<bool> placed(num_pieces + 1, false);
+// Any Random123 CBRNG: key (seed), counter (j, i), first output word mod j + 1
+template <class CBRNG>
+struct CounterRng : CounterKey<CBRNG> {
+    typedef typename CBRNG::ctr_type ctr_type;
+    using CounterKey<CBRNG>::c;
+    using CounterKey<CBRNG>::k;
+    CBRNG rng;
 
-        #pragma omp for
-        for (long long i = 0; i < num_simulations; ++i) {
-            std::iota(pieces.begin(), pieces.end(), 1);
+    CounterRng(uint64_t seed, int) : CounterKey<CBRNG>(seed) {}
 
-            // Initialize Philox RNG from Random123
-            Philox4x32 rng;  // Instantiate the RNG
-            Philox4x32::ctr_type c = {{}};
-            Philox4x32::key_type k = {{}};
+    R123_FORCE_INLINE(int index(int j)) {
+        c[0] = j;
+        ctr_type r = rng(c, k);
+        return static_cast<int>(r[0] % (j + 1));
+    }
+};
 
-            k[0] = tid;  // Use thread ID as part of the key
-            k[1] = i;    // Use iteration number as another part of the key
+// Ways to turn 32 random bits into the swap index in [0, j] (--index)
+enum class IndexMap { Modulo, Lemire, Float };
 
-            // Fisher-Yates shuffle using Philox RNG
-            for (int j = num_pieces - 1; j > 0; --j) {
-                c[0] = j;
-                c[1] = i;
-                Philox4x32::ctr_type r = rng(c, k);  // Generate random numbers
-                int rand_index = r[0] % (j + 1);
-                std::swap(pieces[j], pieces[rand_index]);
-            }
+const IndexMap all_index_maps[] = {IndexMap::Modulo, IndexMap::Lemire, IndexMap::Float};
+
+const char* index_map_name(IndexMap map) {
+    switch (map) {
+    case IndexMap::Lemire: return "lemire";
+    case IndexMap::Float: return "float";
+    default: return "modulo";
+    }
+}
+
+// bits % (j + 1): a hardware division per swap, biased by up to (j + 1) / 2^32
+struct ModuloIndex {
+    template <class Stream>
+    static int index(Stream& stream, int j) {
+        return static_cast<int>(stream.next() % static_cast<uint32_t>(j + 1));
+    }
+};
+
+// r123::bounded: multiply-shift with rejection, unbiased; a division only near a rejection
+struct LemireIndex {
+    template <class Stream>
+    static int index(Stream& stream, int j) {
+        auto next = [&stream] { return stream.next(); };
+        return static_cast<int>(bounded(next, static_cast<uint32_t>(j + 1)));
+    }
+};
+
+// u01<double> scaled by j + 1 and truncated: no division, biased like modulo. u01 adds half a
+// step, so this is floor((bits + 1/2) (j + 1) / 2^32); it differs from LemireIndex when that half
+// step crosses an integer (probability about (j + 1) / 2^33) or Lemire rejects (below (j + 1) / 2^32)
+struct FloatIndex {
+    template <class Stream>
+    static int index(Stream& stream, int j) {
+        return static_cast<int>(u01<double>(stream.next()) * (j + 1));
+    }
+};
 
-            std::fill(placed.begin(), placed.end(), false);
-            int segments = 0;
-            int max_segments = 0;
+// Any Random123 CBRNG, buffered: key (seed), counter (n, i) for the n-th block of trial i.
+// next() hands out each block 32 bits at a time (both halves of a 64-bit word) and bumps the
+// counter only when the block is used up, so one Philox4x32 call serves four swaps, not one;
+// Map turns the bits into swap indices
+template <class CBRNG, class Map = ModuloIndex>
+struct BufferedCounterRng : CounterKey<CBRNG> {
+    typedef typename CBRNG::ctr_type ctr_type;
+    typedef typename ctr_type::value_type word_type;
+    static const int HALVES = sizeof(word_type) / sizeof(uint32_t); // 32-bit draws per output word
+    static const int DRAWS = ctr_type::static_size * HALVES; // 32-bit draws per block
+    using CounterKey<CBRNG>::c;
+    using CounterKey<CBRNG>::k;
+    CBRNG rng;
+    ctr_type block = {{}};
+    int used = DRAWS; // Draws already taken from 'block'
+    long long calls = 0; // CBRNG evaluations so far
 
-            for (int j = 0; j < num_pieces; ++j) {
-                int piece = pieces[j];
-                placed[piece] = true;
+    BufferedCounterRng(uint64_t seed, int) : CounterKey<CBRNG>(seed) {}
+
+    void start(long long i) {
+        CounterKey<CBRNG>::start(i);
+        used = DRAWS;
+    }
 
-                if (placed[piece - 1] && placed[piece + 1]) {
-                    segments--;
-                } else if (!placed[piece - 1] && !placed[piece + 1]) {
-                    segments++;
-                }
+    R123_FORCE_INLINE(uint32_t next()) {
+        if (used == DRAWS) {
+            block = rng(c, k);
+            ++c[0];
+            used = 0;
+            ++calls;
+        }
+        word_type word = block[used / HALVES] >> (32 * (used % HALVES));
+        ++used;
+        return static_cast<uint32_t>(word);
+    }
+
+    R123_FORCE_INLINE(int index(int j)) {
+        return Map::index(*this, j);
+    }
+};
 
-                max_segments = std::max(max_segments, segments);
+// Function to count the generator calls behind 'draws' swap indices: one each, unless buffered
+template <class Rng>
+long long rng_calls(const Rng&, long long draws) {
+    return draws;
+}
+
+template <class CBRNG, class Map>
+long long rng_calls(const BufferedCounterRng<CBRNG, Map>& rng, long long) {
+    return rng.calls;
+}
+
+// std::mt19937_64, mapped to [0, j] with std::uniform_int_distribution
+struct Mt19937Rng {
+    std::mt19937_64 engine;
+
+    Mt19937Rng(uint64_t seed, int tid) {
+        std::seed_seq seq{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32), static_cast<uint32_t>(tid)};
+        engine.seed(seq);
+    }
+
+    void start(long long) {}
+
+    R123_FORCE_INLINE(int index(int j)) {
+        return std::uniform_int_distribution<int>(0, j)(engine);
+    }
+};
+
+// xoshiro512** 1.0 as in Random123/xoshiro512starstar.h, whose state is one global array;
+// here every thread owns a copy, seeded by splitmix64 and moved apart by tid jumps of 2^256
+struct Xoshiro512Rng {
+    uint64_t s[8];
+
+    static inline uint64_t rotl(const uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t next() {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 11;
+        s[2] ^= s[0];
+        s[5] ^= s[1];
+        s[1] ^= s[2];
+        s[7] ^= s[3];
+        s[3] ^= s[4];
+        s[4] ^= s[5];
+        s[0] ^= s[6];
+        s[6] ^= s[7];
+        s[6] ^= t;
+        s[7] = rotl(s[7], 21);
+        return result;
+    }
+
+    void jump() {
+        static const uint64_t JUMP[] = {0x33ed89b6e7a353f9, 0x760083d7955323be, 0x2837f2fbb5f22fae, 0x4b8c5674d309511c,
+                                        0xb11ac47a7ba28c25, 0xf1be7667092bcc1c, 0x53851efdb6df0aaf, 0x1ebbc8b23eaf25db};
+        uint64_t t[8] = {0};
+        for (uint64_t word : JUMP)
+            for (int b = 0; b < 64; b++) {
+                if (word & uint64_t(1) << b)
+                    for (int w = 0; w < 8; w++)
+                        t[w] ^= s[w];
+                next();
             }
+        std::copy(t, t + 8, s);
+    }
+
+    Xoshiro512Rng(uint64_t seed, int tid) {
+        for (uint64_t& word : s) { // splitmix64
+            uint64_t z = (seed += 0x9E3779B97F4A7C15);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            word = z ^ (z >> 31);
+        }
+        for (int t = 0; t < tid; ++t)
+            jump();
+    }
 
-            local_total += max_segments;
+    void start(long long) {}
+
+    R123_FORCE_INLINE(int index(int j)) {
+        return static_cast<int>(next() % static_cast<uint64_t>(j + 1));
+    }
+};
+
+enum class RngKind { Mt19937, Philox, Threefry, Ars, Xoshiro };
+
+const RngKind all_rngs[] = {RngKind::Mt19937, RngKind::Philox, RngKind::Threefry, RngKind::Ars, RngKind::Xoshiro};
+
+const char* rng_name(RngKind kind) {
+    switch (kind) {
+    case RngKind::Mt19937: return "mt19937_64";
+    case RngKind::Threefry: return "threefry4x64";
+    case RngKind::Ars: return "ars4x32";
+    case RngKind::Xoshiro: return "xoshiro512**";
+    default: return "philox4x32";
+    }
+}
+
+// Function to tell whether a backend is counter-based, the only kind --buffered and --index apply to
+bool rng_counter_based(RngKind kind) {
+    return kind == RngKind::Philox || kind == RngKind::Threefry || kind == RngKind::Ars;
+}
+
+// Function to tell whether a backend can run here: ARS needs AES-NI both at compile time and on the CPU
+bool rng_available(RngKind kind) {
+    if (kind != RngKind::Ars)
+        return true;
+#if R123_USE_AES_NI
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+#else
+    return false;
+#endif
+}
+
+// Function to run trials first .. first + count - 1 through 'rng' into 'histogram', returning the
+// number of swap indices drawn. The shuffle and the placement are fused: Fisher-Yates from the back
+// fixes the piece at position j with swap j, so it is placed right away (placing in reverse
+// position order is just as uniform), and the trial stops once max_segments_settled() holds.
+template <int N, class Rng>
+inline long long run_trials(Rng& stream, long long first, long long count, SegmentHistogram<N>& histogram) {
+    Rng rng = stream; // A local copy stays in registers; the state is written back at the end
+    std::array<int, N> pieces;
+    long long draws = 0;
+    for (long long i = first; i < first + count; ++i) {
+        std::iota(pieces.begin(), pieces.end(), 1);
+        rng.start(i);
+
+        Board<N> placed;
+        int segments = 0;
+        int max_segments = 0;
+
+        for (int j = N - 1; j >= 0; --j) {
+            int r = rng.index(j); // index(0) is 0; a trial rarely gets that far
+            int piece = pieces[r];
+            pieces[r] = pieces[j];
+
+            segments += 1 - placed.neighbours(piece);
+            placed.place(piece);
+            max_segments = std::max(max_segments, segments);
+            if (max_segments_settled(segments, j, max_segments)) {
+                draws += N - j;
+                break;
+            }
         }
 
-        #pragma omp atomic
-        total_max_segments += local_total;
+        histogram.add(max_segments);
     }
+    stream = rng;
+    return draws;
+}
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> elapsed = end_time - start_time;
+// Function to draw every swap index of trials first .. first + count - 1 and nothing else
+template <int N, class Rng>
+inline long long run_rng_only(Rng& rng, long long first, long long count) {
+    long long sink = 0;
+    for (long long i = first; i < first + count; ++i) {
+        rng.start(i);
+        for (int j = N - 1; j > 0; --j)
+            sink += rng.index(j);
+    }
+    return sink;
+}
 
-    double average_max_segments = static_cast<double>(total_max_segments) / num_simulations;
+// Function to run the simulation for a board of N pieces and print the results. Each worker
+// builds its own generator on its first chunk, after run_rounds() has pinned it, so the state
+// lives on its node and carries over from round to round
+template <int N, class Rng>
+int run_simulation(const RunSettings& settings) {
+    std::vector<std::unique_ptr<Rng>> thread_rngs(omp_get_max_threads());
+    return run_and_report<N>(settings, [&](int tid, long long first, long long count, SegmentHistogram<N>& histogram) {
+        if (!thread_rngs[tid])
+            thread_rngs[tid].reset(new Rng(settings.seed, tid));
+        run_trials<N>(*thread_rngs[tid], first, count, histogram);
+    });
+}
 
-    std::cout << std::fixed << std::setprecision(6);
-    std::cout << "Average maximum number of segments: " << average_max_segments << std::endl;
-    std::cout << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
+// Function to time one backend on one thread: the full simulation, then all N - 1 draws per trial
+// alone; scaled to the draws the simulation made, their share of the TSC cycles is the RNG's share
+template <int N, class Rng>
+void benchmark_rng(const std::string& name, uint64_t seed, long long num_simulations) {
+    SegmentHistogram<N> histogram;
+    Rng rng(seed, 0);
+    auto start = std::chrono::high_resolution_clock::now();
+    uint64_t start_cycles = __rdtsc();
+    long long draws = run_trials<N>(rng, 0, num_simulations, histogram);
+    uint64_t full_cycles = __rdtsc() - start_cycles;
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
 
-    return 0;
-}
\ No newline at end of file
+    Rng replay(seed, 0);
+    start_cycles = __rdtsc();
+    volatile long long sink = run_rng_only<N>(replay, 0, num_simulations);
+    double rng_cycles = static_cast<double>(__rdtsc() - start_cycles) * draws / (num_simulations * (N - 1.0));
+    (void)sink;
+
+    std::cout << std::setw(31) << name << ": " << std::fixed << std::setprecision(3)
+              << num_simulations / elapsed.count() / 1e6 << " M simulations/s, "
+              << std::setprecision(1) << static_cast<double>(full_cycles) / num_simulations << " cycles/simulation, "
+              << static_cast<double>(draws) / num_simulations << " draws/simulation, "
+              << static_cast<double>(rng_calls(rng, draws)) / num_simulations << " RNG calls/simulation, RNG share "
+              << 100.0 * rng_cycles / full_cycles << "%, average " << std::setprecision(6)
+              << static_cast<double>(histogram.sum()) / num_simulations << std::endl;
+}
+
+// Command-line settings of a run, on top of the shared ones
+struct RunOptions : RunSettings {
+    RngKind rng = RngKind::Philox;
+    bool bench = false;
+    bool buffered = false; // Counter-based backends use every word of each block (BufferedCounterRng)
+    IndexMap index_map = IndexMap::Modulo; // How a buffered backend maps its bits to swap indices
+};
+
+// Function to run one backend on a board of N pieces, in benchmark or simulation mode
+template <int N, class Rng>
+int run_backend(RngKind kind, const RunOptions& settings) {
+    std::string name = rng_name(kind);
+    if (settings.buffered)
+        name += std::string(" (buffered, ") + index_map_name(settings.index_map) + ")";
+    if (settings.bench) {
+        benchmark_rng<N, Rng>(name, settings.seed, settings.num_simulations);
+        return 0;
+    }
+    std::cout << "RNG: " << name << std::endl;
+    return run_simulation<N, Rng>(settings);
+}
+
+// Function to run a counter-based backend one draw per block, or buffered with --buffered
+template <int N, class CBRNG>
+int run_counter_backend(RngKind kind, const RunOptions& settings) {
+    if (!settings.buffered)
+        return run_backend<N, CounterRng<CBRNG>>(kind, settings);
+    switch (settings.index_map) {
+    case IndexMap::Lemire: return run_backend<N, BufferedCounterRng<CBRNG, LemireIndex>>(kind, settings);
+    case IndexMap::Float: return run_backend<N, BufferedCounterRng<CBRNG, FloatIndex>>(kind, settings);
+    default: return run_backend<N, BufferedCounterRng<CBRNG, ModuloIndex>>(kind, settings);
+    }
+}
+
+template <int N>
+int dispatch_rng(RngKind kind, const RunOptions& settings) {
+    switch (kind) {
+    case RngKind::Mt19937: return run_backend<N, Mt19937Rng>(kind, settings);
+    case RngKind::Threefry: return run_counter_backend<N, Threefry4x64>(kind, settings);
+#if R123_USE_AES_NI
+    case RngKind::Ars: return run_counter_backend<N, ARS4x32>(kind, settings);
+#endif
+    case RngKind::Xoshiro: return run_backend<N, Xoshiro512Rng>(kind, settings);
+    case RngKind::Philox: return run_counter_backend<N, Philox4x32>(kind, settings);
+    default: return 1;
+    }
+}
+
+// Function to run backend 'kind' on the board size settings.pieces
+int run_pieces(RngKind kind, const RunOptions& settings) {
+    return dispatch_pieces(settings.pieces, [&](auto pieces) { return dispatch_rng<decltype(pieces)::value>(kind, settings); });
+}
+
+int main(int argc, char* argv[]) {
+    RunOptions settings;
+    bool rng_given = false;
+    bool index_given = false;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        auto named = [&](RngKind k) { return arg.substr(6) == rng_name(k); };
+        auto mapped = [&](IndexMap m) { return arg.substr(8) == index_map_name(m); };
+        if (parse_run_setting(arg, settings))
+            continue; // --simulations, --seed, --pieces and the rest of the shared settings
+        if (arg == "--buffered") {
+            settings.buffered = true;
+        } else if (arg.rfind("--index=", 0) == 0 && std::any_of(std::begin(all_index_maps), std::end(all_index_maps), mapped)) {
+            settings.index_map = *std::find_if(std::begin(all_index_maps), std::end(all_index_maps), mapped);
+            index_given = true;
+        } else if (arg == "--bench") {
+            settings.bench = true;
+        } else if (arg.rfind("--rng=", 0) == 0 && std::any_of(std::begin(all_rngs), std::end(all_rngs), named)) {
+            settings.rng = *std::find_if(std::begin(all_rngs), std::end(all_rngs), named);
+            rng_given = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " " << run_settings_usage() << " [--rng=mt19937_64|philox4x32|threefry4x64|ars4x32|xoshiro512**]"
+                      << " [--buffered] [--index=modulo|lemire|float] [--bench]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (index_given && !settings.buffered) {
+        std::cerr << "--index only applies with --buffered" << std::endl;
+        return 1;
+    }
+    if (settings.buffered && rng_given && !rng_counter_based(settings.rng)) {
+        std::cerr << "--buffered only applies to philox4x32, threefry4x64 and ars4x32, not " << rng_name(settings.rng) << std::endl;
+        return 1;
+    }
+    if (!rng_available(settings.rng)) {
+        std::cerr << rng_name(settings.rng) << " needs AES-NI (build with -maes on a CPU that has it)" << std::endl;
+        return 1;
+    }
+
+    // --bench without --rng runs every backend available here on the same seed, and the
+    // counter-based ones again buffered, once per swap-index mapping
+    if (settings.bench && !rng_given) {
+        std::cout << "Single thread, " << settings.num_simulations << " simulations of " << settings.pieces << " pieces, seed " << settings.seed << std::endl;
+        for (RngKind kind : all_rngs) {
+            if (!rng_available(kind))
+                continue;
+            RunOptions unbuffered = settings;
+            unbuffered.buffered = false;
+            if (run_pieces(kind, unbuffered) != 0)
+                return 1;
+            bool counter_based = rng_counter_based(kind);
+            for (IndexMap map : all_index_maps) {
+                RunOptions buffered = settings;
+                buffered.buffered = true;
+                buffered.index_map = map;
+                if (counter_based && run_pieces(kind, buffered) != 0)
+                    return 1;
+            }
+        }
+        return 0;
+    }
+    return run_pieces(settings.rng, settings);
+}
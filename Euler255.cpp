@@ -4,7 +4,11 @@
 #include <iomanip>
 #include <cmath>
 #include <vector>
+#include <algorithm>
+#include <random>
+#include <string>
 #include <thread>  // For getting the number of hardware threads
+#include <immintrin.h>
 
 // Function to calculate the number of digits in an unsigned long long number
 int numberOfDigits(unsigned long long n) {
@@ -37,11 +41,158 @@ int roundedSquareRoot(unsigned long long n) {
     return iterations;
 }
 
+// Function to give the initial guess for a number of the given digit count, as roundedSquareRoot does
+unsigned long long initialGuess(int digits) {
+    unsigned long long power = 1;
+    for (int i = 0; i < (digits - 1) / 2; ++i)
+        power *= 10;
+    return digits % 2 == 1 ? 2 * power : 7 * power;
+}
+
+// Heron in doubles: for n < 2^53 and x < 2^27 every operand is an exact double, so only n / x can
+// round; ceil of the rounded quotient is then off by at most one, and the exact remainder
+// q * x - n (one FMA) puts it back in [0, x). Lanes run until they all converge; a converged lane
+// keeps x == next, so only its count is masked
+const unsigned long long exactDoubleLimit = 1ULL << 53;
+
+// AVX2 kernel: iteration counts of first .. first + count - 1 (count a multiple of 4), all with initial guess 'guess'
+__attribute__((target("avx2,fma")))
+void heronIterationsAvx2(unsigned long long first, long long count, unsigned long long guess, int* iterations) {
+    const __m256d zero = _mm256_setzero_pd(), half = _mm256_set1_pd(0.5), one = _mm256_set1_pd(1.0);
+    const __m256d start = _mm256_set1_pd(static_cast<double>(guess));
+    __m256d n = _mm256_setr_pd(static_cast<double>(first), static_cast<double>(first + 1), static_cast<double>(first + 2),
+                               static_cast<double>(first + 3));
+    for (long long i = 0; i < count; i += 4, n = _mm256_add_pd(n, _mm256_set1_pd(4.0))) {
+        __m256d x = start, counts = zero;
+        __m256d active = _mm256_cmp_pd(zero, zero, _CMP_EQ_OQ);
+        do {
+            __m256d q = _mm256_ceil_pd(_mm256_div_pd(n, x));
+            __m256d remainder = _mm256_fmsub_pd(q, x, n);
+            q = _mm256_add_pd(q, _mm256_and_pd(_mm256_cmp_pd(remainder, zero, _CMP_LT_OQ), one));
+            q = _mm256_sub_pd(q, _mm256_and_pd(_mm256_cmp_pd(remainder, x, _CMP_GE_OQ), one));
+            __m256d next = _mm256_floor_pd(_mm256_mul_pd(_mm256_add_pd(x, q), half));
+            counts = _mm256_add_pd(counts, _mm256_and_pd(active, one));
+            active = _mm256_and_pd(active, _mm256_cmp_pd(next, x, _CMP_NEQ_OQ));
+            x = next;
+        } while (!_mm256_testz_pd(active, active));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(iterations + i), _mm256_cvtpd_epi32(counts));
+    }
+}
+
+// AVX-512 kernel: as heronIterationsAvx2 on 8 lanes (count a multiple of 8)
+__attribute__((target("avx512f")))
+void heronIterationsAvx512(unsigned long long first, long long count, unsigned long long guess, int* iterations) {
+    const __m512d half = _mm512_set1_pd(0.5), one = _mm512_set1_pd(1.0);
+    const __m512d start = _mm512_set1_pd(static_cast<double>(guess));
+    __m512d n = _mm512_add_pd(_mm512_set1_pd(static_cast<double>(first)), _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7));
+    for (long long i = 0; i < count; i += 8, n = _mm512_add_pd(n, _mm512_set1_pd(8.0))) {
+        __m512d x = start, counts = _mm512_setzero_pd();
+        __mmask8 active = 0xFF;
+        do {
+            __m512d q = _mm512_roundscale_pd(_mm512_div_pd(n, x), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+            __m512d remainder = _mm512_fmsub_pd(q, x, n);
+            q = _mm512_mask_add_pd(q, _mm512_cmp_pd_mask(remainder, _mm512_setzero_pd(), _CMP_LT_OQ), q, one);
+            q = _mm512_mask_sub_pd(q, _mm512_cmp_pd_mask(remainder, x, _CMP_GE_OQ), q, one);
+            __m512d next = _mm512_roundscale_pd(_mm512_mul_pd(_mm512_add_pd(x, q), half), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+            counts = _mm512_mask_add_pd(counts, active, counts, one);
+            active = _mm512_mask_cmp_pd_mask(active, next, x, _CMP_NEQ_OQ);
+            x = next;
+        } while (active);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(iterations + i), _mm512_cvtpd_epi32(counts));
+    }
+}
+
+enum class Kernel { Scalar, Avx2, Avx512 };
+
+// Function to pick the widest kernel this CPU supports
+Kernel detectKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return Kernel::Avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return Kernel::Avx2;
+    return Kernel::Scalar;
+}
+
+int kernelLanes(Kernel kernel) {
+    return kernel == Kernel::Avx512 ? 8 : kernel == Kernel::Avx2 ? 4 : 1;
+}
+
+const char* kernelName(Kernel kernel) {
+    return kernel == Kernel::Avx512 ? "avx512" : kernel == Kernel::Avx2 ? "avx2" : "scalar";
+}
+
+// Function to store roundedSquareRoot(n) for n in [first, first + count) in 'iterations': whole vectors
+// of numbers with one digit count below 2^53 on the vector kernel, everything else on the scalar one
+void heronIterations(Kernel kernel, unsigned long long first, long long count, int* iterations) {
+    int lanes = kernelLanes(kernel);
+    unsigned long long end = first + count;
+    unsigned long long power = 1;  // Smallest number with 'digits' digits
+    int digits = 1;
+    while (power * 10 <= first) {
+        power *= 10;
+        ++digits;
+    }
+    for (unsigned long long n = first; n < end; ++digits, power *= 10) {
+        unsigned long long digitsEnd = std::min(end, power * 10);
+        long long batches = digitsEnd <= exactDoubleLimit ? static_cast<long long>(digitsEnd - n) / lanes : 0;
+        if (kernel == Kernel::Avx512)
+            heronIterationsAvx512(n, batches * lanes, initialGuess(digits), iterations + (n - first));
+        else if (kernel == Kernel::Avx2)
+            heronIterationsAvx2(n, batches * lanes, initialGuess(digits), iterations + (n - first));
+        else
+            batches = 0;
+        for (n += batches * lanes; n < digitsEnd; ++n)
+            iterations[n - first] = roundedSquareRoot(n);
+    }
+}
+
+// Function to sum the iteration counts over [lo, hi), where every n has reached the iterate x after
+// 'iterations' steps. The next iterate (x + ceil(n / x)) / 2 only changes when ceil(n / x) moves past
+// a pair of quotients, so the range splits into consecutive blocks of 2x numbers whose next iterates
+// count up by one; each block either stops here or recurses with its own iterate
+unsigned long long sumIterationsFrom(unsigned long long lo, unsigned long long hi, unsigned long long x, int iterations,
+                                     unsigned long long& blocks) {
+    unsigned long long total = 0;
+    unsigned long long next = (x + (lo + x - 1) / x) / 2;  // The only division; later blocks step 'next'
+    for (unsigned long long n = lo; n < hi; ++next) {
+        unsigned long long blockEnd = std::min(hi, (2 * next + 1 - x) * x + 1);  // Past the last n with this 'next'
+        ++blocks;
+        if (next == x) {
+            total += (blockEnd - n) * (iterations + 1);
+        } else if ((next - 1) * next < n && blockEnd - 1 <= (next + 1) * next) {
+            // ceil(n / next) is next or next + 1 across the block, so 'next' is final: skip the call
+            total += (blockEnd - n) * (iterations + 2);
+        } else {
+            total += sumIterationsFrom(n, blockEnd, next, iterations + 1, blocks);
+        }
+        n = blockEnd;
+    }
+    return total;
+}
+
+// Function to sum roundedSquareRoot(n) over [lo, hi) without visiting each n, splitting at digit counts
+unsigned long long sumIterations(unsigned long long lo, unsigned long long hi, unsigned long long& blocks) {
+    unsigned long long total = 0;
+    unsigned long long power = 1;  // Smallest number with 'digits' digits
+    for (int digits = 1; lo < hi; ++digits, power *= 10) {
+        unsigned long long digitsEnd = std::min(hi, power * 10);
+        if (lo < digitsEnd) {
+            total += sumIterationsFrom(lo, digitsEnd, initialGuess(digits), 0, blocks);
+            lo = digitsEnd;
+        }
+    }
+    return total;
+}
+
 // Thread arguments struct
 struct ThreadArgs {
     unsigned long long startRange;
     unsigned long long endRange;
+    bool useIntervals;  // sumIterations instead of one roundedSquareRoot per n
+    Kernel kernel;      // How the one-at-a-time loop evaluates roundedSquareRoot
     unsigned long long totalIterations;
+    unsigned long long blocks;  // Blocks sumIterations went through
 };
 
 // Function that each thread will execute
@@ -49,19 +200,30 @@ void* threadFunction(void* arg) {
     ThreadArgs* args = (ThreadArgs*)arg;
     unsigned long long totalIterations = 0;
 
-    // Loop over the assigned range and calculate the iterations
-    for (unsigned long long n = args->startRange; n < args->endRange; ++n) {
-        int iterations = roundedSquareRoot(n);
-        totalIterations += iterations;
+    if (args->useIntervals) {
+        args->blocks = 0;
+        args->totalIterations = sumIterations(args->startRange, args->endRange, args->blocks);
+        return nullptr;
+    }
+
+    // Loop over the assigned range in chunks and calculate the iterations
+    const long long chunk = 4096;
+    std::vector<int> iterations(chunk);
+    for (unsigned long long n = args->startRange; n < args->endRange; n += chunk) {
+        long long count = std::min<unsigned long long>(chunk, args->endRange - n);
+        heronIterations(args->kernel, n, count, iterations.data());
+        for (long long i = 0; i < count; ++i)
+            totalIterations += iterations[i];
     }
 
     args->totalIterations = totalIterations;
     return nullptr;
 }
 
-int main() {
-    const unsigned long long startRange = 10000000000000ULL;  // Start of the range 10^13
-    const unsigned long long endRange = 100000000000000ULL;   // End of the range 10^14 (exclusive)
+// Function to sum roundedSquareRoot(n) over [startRange, endRange) on all hardware threads, one n at a
+// time on 'kernel' or, with useIntervals, by sumIterations on each thread's share
+unsigned long long parallelIterations(unsigned long long startRange, unsigned long long endRange, bool useIntervals,
+                                      Kernel kernel, unsigned long long& blocks) {
     unsigned long long numberOfNumbers = endRange - startRange;  // Total numbers in the range
 
     // Get the number of hardware threads (cores)
@@ -76,14 +238,14 @@ int main() {
 
     unsigned long long numbersPerThread = numberOfNumbers / numThreads;
 
-    // Start measuring time
-    auto start = std::chrono::high_resolution_clock::now();
-
     // Create and launch threads
     for (unsigned int i = 0; i < numThreads; ++i) {
         threadArgs[i].startRange = startRange + i * numbersPerThread;
         threadArgs[i].endRange = (i == numThreads - 1) ? endRange : threadArgs[i].startRange + numbersPerThread;
+        threadArgs[i].useIntervals = useIntervals;
+        threadArgs[i].kernel = kernel;
         threadArgs[i].totalIterations = 0;
+        threadArgs[i].blocks = 0;
         pthread_create(&threads[i], nullptr, threadFunction, &threadArgs[i]);
     }
 
@@ -92,7 +254,118 @@ int main() {
     for (unsigned int i = 0; i < numThreads; ++i) {
         pthread_join(threads[i], nullptr);
         totalIterations += threadArgs[i].totalIterations;
+        blocks += threadArgs[i].blocks;
+    }
+
+    return totalIterations;
+}
+
+// Function to time every kernel this CPU supports on one thread over [first, first + count); every
+// vector kernel must give the scalar one's count for each n
+bool benchmarkKernels(unsigned long long first, long long count) {
+    Kernel best = detectKernel();
+    std::vector<int> reference(count), iterations(count);
+    bool identical = true;
+    std::cout << "Single thread, " << count << " numbers from " << first << std::endl;
+    for (Kernel kernel : {Kernel::Scalar, Kernel::Avx2, Kernel::Avx512}) {
+        if (kernelLanes(kernel) > kernelLanes(best))
+            break;
+        auto start = std::chrono::high_resolution_clock::now();
+        heronIterations(kernel, first, count, kernel == Kernel::Scalar ? reference.data() : iterations.data());
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        unsigned long long total = 0;
+        long long differing = 0;
+        for (long long i = 0; i < count; ++i) {
+            int value = kernel == Kernel::Scalar ? reference[i] : iterations[i];
+            total += value;
+            differing += value != reference[i];
+        }
+        identical = identical && differing == 0;
+        std::cout << std::setw(7) << kernelName(kernel) << ": " << std::setprecision(3) << count / elapsed.count() / 1e6
+                  << " M numbers/s, total " << total << ", " << differing << " counts differ from scalar" << std::endl;
+    }
+    return identical;
+}
+
+// Function to compare sumIterations with the one-at-a-time loop on 'count' random subranges of 'length'
+// numbers in [startRange, endRange), plus the two ends of the range; returns the number of mismatches
+int crossCheck(unsigned long long startRange, unsigned long long endRange, int count, unsigned long long length, unsigned long long seed,
+               Kernel kernel) {
+    std::mt19937_64 engine(seed);
+    std::uniform_int_distribution<unsigned long long> pick(startRange, endRange - length);
+    std::vector<unsigned long long> starts = {startRange, endRange - length};
+    for (int i = 0; i < count; ++i)
+        starts.push_back(pick(engine));
+
+    int mismatches = 0;
+    for (unsigned long long first : starts) {
+        unsigned long long blocks = 0;
+        unsigned long long fast = sumIterations(first, first + length, blocks);
+        unsigned long long slow = parallelIterations(first, first + length, false, kernel, blocks);
+        if (fast != slow) {
+            std::cout << "Mismatch on [" << first << ", " << first + length << "): " << fast << " vs " << slow << std::endl;
+            ++mismatches;
+        }
     }
+    std::cout << "Cross-check: " << starts.size() - mismatches << " of " << starts.size() << " subranges of "
+              << length << " numbers agree with the brute force" << std::endl;
+    return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned long long startRange = 10000000000000ULL;  // Start of the range 10^13
+    const unsigned long long endRange = 100000000000000ULL;   // End of the range 10^14 (exclusive)
+    unsigned long long numberOfNumbers = endRange - startRange;  // Total numbers in the range
+    bool bruteForce = false;  // --brute: visit every n, as before the interval engine (hours)
+    int checks = 0;           // --check=<k>: cross-check k random subranges against the brute force
+    unsigned long long checkLength = 1000000;
+    unsigned long long seed = 255;
+    Kernel kernel = detectKernel();  // --kernel: how --brute and --check evaluate each n
+    bool bench = false;              // --bench: time the kernels on --bench-length numbers from 10^13
+    long long benchLength = 10000000;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        if (arg == "--brute") {
+            bruteForce = true;
+        } else if (arg.rfind("--check=", 0) == 0) {
+            checks = std::stoi(arg.substr(8));
+        } else if (arg.rfind("--check-length=", 0) == 0 && std::stoull(arg.substr(15)) >= 1 && std::stoull(arg.substr(15)) <= numberOfNumbers) {
+            checkLength = std::stoull(arg.substr(15));
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            seed = std::stoull(arg.substr(7));
+        } else if (arg == "--kernel=scalar") {
+            kernel = Kernel::Scalar;
+        } else if (arg == "--kernel=avx2") {
+            kernel = Kernel::Avx2;
+        } else if (arg == "--kernel=avx512") {
+            kernel = Kernel::Avx512;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg.rfind("--bench-length=", 0) == 0 && std::stoll(arg.substr(15)) >= 1) {
+            benchLength = std::stoll(arg.substr(15));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--brute] [--check=<k>] [--check-length=<n>] [--seed=<n>]"
+                      << " [--kernel=scalar|avx2|avx512] [--bench] [--bench-length=<n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (kernelLanes(kernel) > kernelLanes(detectKernel())) {
+        std::cerr << "This CPU does not support the " << kernelName(kernel) << " kernel" << std::endl;
+        return 1;
+    }
+    if (bench)
+        return benchmarkKernels(startRange, benchLength) ? 0 : 1;
+    if (checks > 0 && crossCheck(startRange, endRange, checks, checkLength, seed, kernel) != 0)
+        return 1;
+
+    // Start measuring time
+    auto start = std::chrono::high_resolution_clock::now();
+
+    unsigned long long blocks = 0;
+    unsigned long long totalIterations = parallelIterations(startRange, endRange, !bruteForce, kernel, blocks);
 
     // Stop measuring time
     auto end = std::chrono::high_resolution_clock::now();
@@ -104,6 +377,10 @@ int main() {
     // Output the results
     std::cout << "Average number of iterations for the range [10^13, 10^14): " 
               << std::fixed << std::setprecision(10) << averageIterations << std::endl;
+    if (bruteForce)
+        std::cout << "Kernel: " << kernelName(kernel) << std::endl;
+    else
+        std::cout << "Blocks with a shared iterate sequence: " << blocks << std::endl;
     std::cout << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
 
     return 0;
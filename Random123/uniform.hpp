@@ -78,6 +78,22 @@ These functions apply the corresponding conversion to every
 element of their argument, which must be a staticly sized
 array, e.g., an r123array or a std::array of an integer type.
 
+For integers in a range, there are also:
+
+ - boundedaccept:  maps one 32- or 64-bit integer onto [0, n) by
+    Lemire's multiply-shift, (in*n)>>W, and reports whether the
+    result may be used without bias.
+
+ - bounded:  draws from a generator until boundedaccept succeeds,
+    giving an unbiased value in [0, n).
+
+ - boundedall (C++11 and newer):  applies boundedaccept to every
+    element of an r123array, redrawing rejected elements with bounded.
+
+Unlike in % n, multiply-shift needs no division except in the rare
+case (probability < n/2^W) that the low half of the product falls
+in the rejection zone.
+
 This file may not be as portable, and has not been tested as
 rigorously as other files in the library, e.g., the generators.
 Nevertheless, we hope it is useful and we encourage developers to
@@ -247,6 +263,69 @@ R123_CUDA_DEVICE R123_STATIC_INLINE Ftype u01fixedpt(Itype in){
         return u01<Ftype>(in);
 }
 
+/** @cond HIDDEN_FROM_DOXYGEN */
+// W x W -> 2W-bit products for the bounded functions: high half returned, low half in *lo
+R123_CUDA_DEVICE R123_STATIC_INLINE uint32_t boundedmulhilo(uint32_t a, uint32_t b, uint32_t* lo){
+    uint64_t product = uint64_t(a)*b;
+    *lo = uint32_t(product);
+    return uint32_t(product>>32);
+}
+
+R123_CUDA_DEVICE R123_STATIC_INLINE uint64_t boundedmulhilo(uint64_t a, uint64_t b, uint64_t* lo){
+#if R123_USE_GNU_UINT128
+    __uint128_t product = (__uint128_t)a*b;
+    *lo = uint64_t(product);
+    return uint64_t(product>>64);
+#else
+    uint64_t alo = a & 0xffffffff, ahi = a>>32, blo = b & 0xffffffff, bhi = b>>32;
+    uint64_t ll = alo*blo, lh = alo*bhi, hl = ahi*blo, hh = ahi*bhi;
+    uint64_t mid = (ll>>32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+    *lo = (mid<<32) | (ll & 0xffffffff);
+    return hh + (lh>>32) + (hl>>32) + (mid>>32);
+#endif
+}
+/** @endcond */
+
+//! Map a W-bit integer onto [0, n) by multiply-shift, flagging the values that would bias it
+/**
+    @ingroup uniform
+   Utype must be uint32_t or uint64_t, and n must be nonzero.
+   Stores (in*n)>>W in *out.  Each of the n results comes from
+   floor(2^W/n) or ceil(2^W/n) inputs; the 2^W mod n surplus inputs are
+   exactly those whose product has a low half below 2^W mod n, and for
+   them the function returns false.  If the input is uniformly
+   distributed, the accepted outputs are uniformly distributed in [0, n).
+
+   The remainder 2^W mod n is only computed when the low half is below n,
+   so the usual cost is one multiplication.
+*/
+template <typename Utype>
+R123_CUDA_DEVICE R123_STATIC_INLINE bool boundedaccept(Utype in, Utype n, Utype* out){
+    Utype lo;
+    *out = boundedmulhilo(in, n, &lo);
+    if(lo < n){
+        Utype threshold = Utype(-n) % n; // 2^W mod n
+        return lo >= threshold;
+    }
+    return true;
+}
+
+//! Return an unbiased integer in [0, n), drawing W-bit integers from gen() until one is accepted
+/**
+    @ingroup uniform
+   Utype must be uint32_t or uint64_t, and n must be nonzero.  gen is any
+   callable returning uniformly distributed Utype values, e.g., a
+   MicroURNG or a lambda over a counter-based stream.  Lemire's method
+   rejects fewer than n/2^W of the draws, so gen() is almost always called
+   once.
+*/
+template <typename Utype, typename Gen>
+R123_CUDA_DEVICE R123_STATIC_INLINE Utype bounded(Gen& gen, Utype n){
+    Utype out;
+    while(!boundedaccept<Utype>(Utype(gen()), n, &out)){}
+    return out;
+}
+
 #if R123_USE_CXX11_STD_ARRAY
 
 //! Apply u01 to every item in an r123array, returning a std::array
@@ -302,6 +381,29 @@ std::array<Ftype, CollType::static_size> u01fixedptall(CollType in)
     }
     return ret;
 }
+
+//! Map every item of an r123array onto [0, n) without bias, returning a std::array
+/** @ingroup uniform
+ * Only in C++11 and newer.
+ * The argument type may be any collection of uint32_t or uint64_t with a constexpr
+ * static_size member, e.g., an r123array4x32 or r123array4x64.  Each item is mapped by
+ * boundedaccept; a rejected item is replaced by bounded(gen, n), so gen() is only
+ * called with probability < n/2^W per item.
+ */
+template <typename CollType, typename Gen>
+static inline
+std::array<typename CollType::value_type, CollType::static_size> boundedall(CollType in, typename CollType::value_type n, Gen& gen)
+{
+    typedef typename CollType::value_type Utype;
+    std::array<Utype, CollType::static_size> ret;
+    auto p = ret.begin();
+    for(auto e : in){
+        if(!boundedaccept<Utype>(e, n, &*p))
+            *p = bounded<Utype>(gen, n);
+        ++p;
+    }
+    return ret;
+}
 #endif // __cplusplus >= 201103L
 
 } // namespace r123